@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+"""Record, inspect and replay BLE advertisements captured by a Kelvin gateway.
+
+Usage:
+    capture.py start HOST                 start a new capture on the gateway
+    capture.py stop HOST                  stop capturing
+    capture.py download HOST FILE         download the capture file
+    capture.py dump FILE                  print the records in chronological order
+    capture.py upload HOST FILE           upload a capture file to the gateway
+    capture.py replay HOST [SPEED]        replay the gateway's capture file in a
+                                          sandbox, SPEED is a multiplier (0 = no delays)
+    capture.py status HOST                show the results of the last replay
+
+Replays on the gateway never publish anything nor touch its readings or names.
+To see what the gateway would publish for a downloaded capture, replay it on
+the host:
+    pio run -e replay
+    .pio/build/replay/program FILE
+Regression tests replaying a fixed capture run with `pio test -e native`, see
+test/test_replay.
+"""
+
+import struct
+import sys
+import urllib.request
+import uuid
+
+MAGIC = 0x434C564B
+VERSION = 1
+
+HEADER = struct.Struct("<IBBHI")
+RECORD = struct.Struct("<I6sbBB23sB27s")
+
+HAVE_NAME = 1 << 0
+HAVE_THERMOMETER_DATA = 1 << 1
+
+
+def request(host, method, path, data=None, headers={}):
+    req = urllib.request.Request(f"http://{host}{path}", data=data, method=method, headers=headers)
+    with urllib.request.urlopen(req) as response:
+        return response.read()
+
+
+def parse(blob):
+    magic, version, record_size, capacity, count = HEADER.unpack_from(blob)
+    if magic != MAGIC or version != VERSION or record_size != RECORD.size:
+        raise ValueError("not a Kelvin capture file or unsupported version")
+
+    total = min(count, capacity)
+    oldest = count % capacity if count > capacity else 0
+    for i in range(total):
+        offset = HEADER.size + ((oldest + i) % capacity) * RECORD.size
+        timestamp, address, rssi, flags, data_length, data, name_length, name = RECORD.unpack_from(blob, offset)
+        yield {
+            "timestamp": timestamp,
+            "address": ":".join(f"{b:02x}" for b in address),
+            "rssi": rssi,
+            "name": name[:name_length].decode(errors="replace") if flags & HAVE_NAME else None,
+            "data": data[:data_length] if flags & HAVE_THERMOMETER_DATA else None,
+        }
+
+
+def dump(path):
+    with open(path, "rb") as f:
+        records = list(parse(f.read()))
+
+    if not records:
+        return
+
+    start = records[0]["timestamp"]
+    for record in records:
+        data = record["data"].hex() if record["data"] is not None else "-"
+        name = record["name"] if record["name"] is not None else "-"
+        print(f"{(record['timestamp'] - start) / 1000:10.3f} {record['address']} {record['rssi']:4d} {data:30} {name}")
+
+
+def upload(host, path):
+    with open(path, "rb") as f:
+        content = f.read()
+
+    # validate before sending
+    list(parse(content))
+
+    boundary = uuid.uuid4().hex
+    body = (
+        f"--{boundary}\r\n"
+        'Content-Disposition: form-data; name="file"; filename="capture.bin"\r\n'
+        "Content-Type: application/octet-stream\r\n\r\n"
+    ).encode() + content + f"\r\n--{boundary}--\r\n".encode()
+
+    request(host, "PUT", "/capture", body, {"Content-Type": f"multipart/form-data; boundary={boundary}"})
+
+
+def main(argv):
+    if len(argv) < 3:
+        sys.exit(__doc__)
+
+    command = argv[1]
+    if command == "start":
+        request(argv[2], "POST", "/capture")
+    elif command == "stop":
+        request(argv[2], "DELETE", "/capture")
+    elif command == "download" and len(argv) == 4:
+        with open(argv[3], "wb") as f:
+            f.write(request(argv[2], "GET", "/capture"))
+    elif command == "dump":
+        dump(argv[2])
+    elif command == "upload" and len(argv) == 4:
+        upload(argv[2], argv[3])
+    elif command == "replay":
+        speed = argv[3] if len(argv) > 3 else "1"
+        request(argv[2], "POST", f"/capture/replay?speed={speed}")
+    elif command == "status":
+        print(request(argv[2], "GET", "/capture/replay").decode())
+    else:
+        sys.exit(__doc__)
+
+
+if __name__ == "__main__":
+    main(sys.argv)
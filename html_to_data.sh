@@ -3,5 +3,19 @@
 cd "$(dirname $0)"
 
 rm -rf data/html
-cp -r html data/
-gzip -9 data/html/*
+mkdir -p data/html
+
+# Every asset is stored gzipped only, the manifest maps asset names to
+# content hashes, which the firmware uses as ETags.
+{
+    echo "{"
+    separator=""
+    for path in html/*; do
+        name="$(basename "$path")"
+        gzip -9 -n < "$path" > "data/html/$name.gz"
+        hash="$(sha1sum "$path" | cut -c1-16)"
+        printf '%s    "%s": "%s"' "$separator" "$name" "$hash"
+        separator=$',\n'
+    done
+    printf '\n}\n'
+} > data/html/assets.json
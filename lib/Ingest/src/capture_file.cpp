@@ -0,0 +1,51 @@
+#include <cstring>
+
+#include "capture_file.h"
+
+namespace Ingest {
+
+bool is_valid(const CaptureHeader & header) {
+    return (header.magic == CAPTURE_MAGIC)
+           && (header.version == CAPTURE_VERSION)
+           && (header.record_size == sizeof(Advertisement))
+           && (header.capacity > 0);
+}
+
+uint32_t get_record_count(const CaptureHeader & header) {
+    return header.count < header.capacity ? header.count : header.capacity;
+}
+
+size_t get_capture_size(const CaptureHeader & header) {
+    return sizeof(CaptureHeader) + get_record_count(header) * sizeof(Advertisement);
+}
+
+size_t get_record_offset(const CaptureHeader & header, uint32_t index) {
+    const uint32_t oldest = header.count > header.capacity ? header.count % header.capacity : 0;
+    return sizeof(CaptureHeader) + ((oldest + index) % header.capacity) * sizeof(Advertisement);
+}
+
+size_t get_append_offset(const CaptureHeader & header) {
+    return sizeof(CaptureHeader) + (header.count % header.capacity) * sizeof(Advertisement);
+}
+
+bool parse_capture(const uint8_t * data, size_t size, std::vector<Advertisement> & advertisements) {
+    CaptureHeader header;
+    if (size < sizeof(header)) {
+        return false;
+    }
+
+    memcpy(&header, data, sizeof(header));
+    if (!is_valid(header) || (size != get_capture_size(header))) {
+        return false;
+    }
+
+    const uint32_t count = get_record_count(header);
+    advertisements.resize(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        memcpy(&advertisements[i], data + get_record_offset(header, i), sizeof(Advertisement));
+    }
+
+    return true;
+}
+
+}
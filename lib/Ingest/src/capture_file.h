@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ingest.h"
+
+// Capture files are a header followed by a ring of fixed size Advertisement
+// records.  While the ring is not full, records are simply appended.
+
+namespace Ingest {
+
+const uint32_t CAPTURE_MAGIC = 0x434c564b;  // "KVLC"
+const uint8_t CAPTURE_VERSION = 1;
+
+struct CaptureHeader {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t record_size;
+    uint16_t capacity;
+    uint32_t count;         // total number of records ever written
+} __attribute__((packed));
+
+bool is_valid(const CaptureHeader & header);
+
+// Number of records stored in the file.
+uint32_t get_record_count(const CaptureHeader & header);
+
+// Expected file size for the given header.
+size_t get_capture_size(const CaptureHeader & header);
+
+// Offset of the index-th record in chronological order.
+size_t get_record_offset(const CaptureHeader & header, uint32_t index);
+
+// Offset at which the next record is written.
+size_t get_append_offset(const CaptureHeader & header);
+
+bool parse_capture(const uint8_t * data, size_t size, std::vector<Advertisement> & advertisements);
+
+}
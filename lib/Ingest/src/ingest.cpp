@@ -0,0 +1,194 @@
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+#include "ingest.h"
+
+namespace {
+
+const uint32_t RECENT_READING_MILLIS = 120 * 1000;
+const uint32_t ACTIVE_SCAN_TIMEOUT_MILLIS = 3 * 60 * 1000;
+
+int parse_hex_digit(char c) {
+    if ((c >= '0') && (c <= '9')) {
+        return c - '0';
+    } else if ((c >= 'a') && (c <= 'f')) {
+        return c - 'a' + 10;
+    } else if ((c >= 'A') && (c <= 'F')) {
+        return c - 'A' + 10;
+    } else {
+        return -1;
+    }
+}
+
+}
+
+namespace Ingest {
+
+std::string to_string(const Address & address) {
+    char buffer[18];
+    snprintf(buffer, sizeof(buffer), "%02x:%02x:%02x:%02x:%02x:%02x",
+             address[0], address[1], address[2], address[3], address[4], address[5]);
+    return buffer;
+}
+
+bool parse_address(const char * str, Address & address) {
+    for (size_t i = 0; i < address.size(); ++i) {
+        const int hi = parse_hex_digit(str[0]);
+        const int lo = (hi >= 0) ? parse_hex_digit(str[1]) : -1;
+        if (lo < 0) {
+            return false;
+        }
+        address[i] = (hi << 4) | lo;
+        str += 2;
+
+        const char separator = (i + 1 < address.size()) ? ':' : '\0';
+        if (*str++ != separator) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Address Advertisement::get_address() const {
+    Address ret;
+    memcpy(ret.data(), address, ret.size());
+    return ret;
+}
+
+std::string Advertisement::get_name() const {
+    return std::string(name, name_length);
+}
+
+Gateway::Gateway(Environment & environment):
+    environment(environment), active_scan_enabled(false), active_scan_required(false), active_scan_start(0),
+    just_reconnected(false) {
+}
+
+void Gateway::log(bool verbose, const char * format, ...) {
+    char buffer[128];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+
+    if (verbose) {
+        environment.debug(buffer);
+    } else {
+        environment.log(buffer);
+    }
+}
+
+void Gateway::process(const Advertisement & advertisement) {
+    const Address address = advertisement.get_address();
+    const std::string address_str = to_string(address);
+
+    bool have_name = environment.get_name(address);
+    if (!have_name && (advertisement.flags & Advertisement::HAVE_NAME)) {
+        const std::string name = advertisement.get_name();
+        if (name.length() > 0) {
+            log(false, "Assigning name %s to %s", name.c_str(), address_str.c_str());
+            environment.set_name(address, name);
+            have_name = true;
+        }
+    }
+
+    if (!(advertisement.flags & Advertisement::HAVE_THERMOMETER_DATA)) {
+        return;
+    }
+
+    struct {
+        // uint8_t     size;   // = 18
+        // uint8_t     uid;    // = 0x16, 16-bit UUID
+        // uint16_t    UUID;   // = 0x181A, GATT Service 0x181A Environmental Sensing
+        uint8_t     MAC[6]; // [0] - lo, .. [6] - hi digits
+        int16_t     temperature;    // x 0.01 degree
+        uint16_t    humidity;       // x 0.01 %
+        uint16_t    battery_mv;     // mV
+        uint8_t     battery_level;  // 0..100 %
+        uint8_t     counter;        // measurement count
+        uint8_t     flags;  // GPIO_TRG pin (marking "reset" on circuit board) flags:
+        // bit0: Reed Switch, input
+        // bit1: GPIO_TRG pin output value (pull Up/Down)
+        // bit2: Output GPIO_TRG pin is controlled according to the set parameters
+        // bit3: Temperature trigger event
+        // bit4: Humidity trigger event
+    } __attribute__((packed)) data;
+
+    if (sizeof(data) != advertisement.data_length) {
+        return;
+    }
+
+    memcpy(&data, advertisement.data, sizeof(data));
+
+    Reading reading;
+    reading.temperature = 0.01 * (double) data.temperature;
+    reading.humidity = 0.01 * (double) data.humidity;
+    reading.battery_level = data.battery_level;
+    reading.battery_voltage = 0.001 * (double) data.battery_mv;
+    reading.timestamp = environment.millis();
+    reading.published = false;
+
+    const char * name = have_name ? environment.get_name(address) : "<unknown>";
+    const bool first_reading = (readings.count(address) == 0);
+    if (first_reading) {
+        log(false, "Got first reading from %s (%s)", address_str.c_str(), name);
+    } else {
+        log(true, "Got reading from %s (%s)", address_str.c_str(), name);
+    }
+
+    if (!have_name && first_reading) {
+        active_scan_required = true;
+        log(false, "Requesting active scan.");
+    }
+
+    readings[address] = reading;
+}
+
+void Gateway::publish_readings() {
+    const uint32_t now = environment.millis();
+
+    bool got_all_names = true;
+
+    for (auto & kv : readings) {
+        const auto & address = kv.first;
+        auto & reading = kv.second;
+
+        const bool recent = (now - reading.timestamp <= RECENT_READING_MILLIS);
+
+        const char * name = environment.get_name(address);
+        got_all_names = got_all_names && name;
+
+        if (reading.published && !(recent && just_reconnected)) {
+            // already published and we haven't just reconnected
+            continue;
+        }
+
+        environment.publish(address, name, reading);
+        reading.published = true;
+    }
+
+    just_reconnected = false;
+
+    if (active_scan_enabled && (got_all_names || (now - active_scan_start >= ACTIVE_SCAN_TIMEOUT_MILLIS))) {
+        log(false, "Disabling active scan.");
+        active_scan_enabled = false;
+        environment.set_active_scan(false);
+    } else if (active_scan_required) {
+        active_scan_start = now;
+        if (!active_scan_enabled) {
+            log(false, "Enabling active scan.");
+            active_scan_enabled = true;
+            environment.set_active_scan(true);
+        }
+    }
+
+    active_scan_required = false;
+}
+
+void Gateway::enable_active_scan() {
+    active_scan_enabled = true;
+    environment.set_active_scan(true);
+}
+
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string>
+
+// Advertisement decoding and publishing decisions, kept free of Arduino
+// dependencies so that they can be tested and benchmarked on the host.
+
+namespace Ingest {
+
+typedef std::array<uint8_t, 6> Address;
+
+std::string to_string(const Address & address);
+bool parse_address(const char * str, Address & address);
+
+// A single received advertisement.  This is also the record format of capture
+// files, so the layout must not change without bumping the capture version.
+struct Advertisement {
+    enum Flags : uint8_t {
+        HAVE_NAME = 1 << 0,
+        HAVE_THERMOMETER_DATA = 1 << 1,
+    };
+
+    uint32_t timestamp;     // milliseconds
+    uint8_t address[6];
+    int8_t rssi;
+    uint8_t flags;
+    uint8_t data_length;
+    uint8_t data[23];       // environmental sensing (0x181a) service data
+    uint8_t name_length;
+    char name[27];
+
+    Address get_address() const;
+    std::string get_name() const;
+} __attribute__((packed));
+
+static_assert(sizeof(Advertisement) == 64, "Advertisement record size changed");
+
+struct Reading {
+    double temperature;
+    double humidity;
+    unsigned int battery_level;
+    double battery_voltage;
+    uint32_t timestamp;     // Environment::millis() at reception
+    bool published;
+};
+
+// Everything the gateway logic needs from the outside world.
+class Environment {
+    public:
+        virtual ~Environment() {}
+
+        virtual uint32_t millis() = 0;
+
+        virtual const char * get_name(const Address & address) = 0;
+        virtual void set_name(const Address & address, const std::string & name) = 0;
+
+        virtual void publish(const Address & address, const char * name, const Reading & reading) = 0;
+        virtual void set_active_scan(bool enabled) = 0;
+
+        virtual void log(const char * message) = 0;
+        virtual void debug(const char * message) = 0;
+};
+
+class Gateway {
+    public:
+        Gateway(Environment & environment);
+
+        void process(const Advertisement & advertisement);
+        void publish_readings();
+
+        // Republish recent readings on the next publish_readings() call.
+        void reconnected() { just_reconnected = true; }
+
+        // Switches active scan on, the timeout still counts from the last time it was requested.
+        void enable_active_scan();
+        bool is_active_scan_enabled() const { return active_scan_enabled; }
+
+        const std::map<Address, Reading> & get_readings() const { return readings; }
+
+    protected:
+        void log(bool verbose, const char * format, ...) __attribute__((format(printf, 3, 4)));
+
+        Environment & environment;
+        std::map<Address, Reading> readings;
+
+        bool active_scan_enabled;
+        bool active_scan_required;
+        uint32_t active_scan_start;
+        bool just_reconnected;
+};
+
+}
@@ -0,0 +1,33 @@
+#include "replay.h"
+
+namespace Ingest {
+
+void Replay::feed(const Advertisement & advertisement) {
+    advance(advertisement.timestamp);
+    gateway.process(advertisement);
+    gateway.publish_readings();
+}
+
+void Replay::advance(uint32_t timestamp) {
+    now = timestamp;
+    gateway.publish_readings();
+}
+
+const char * Replay::get_name(const Address & address) {
+    const auto it = names.find(address);
+    return it != names.end() ? it->second.c_str() : nullptr;
+}
+
+void Replay::set_name(const Address & address, const std::string & name) {
+    names[address] = name;
+}
+
+void Replay::publish(const Address & address, const char * name, const Reading & reading) {
+    publications.push_back({now, address, name ? name : "", reading.temperature, reading.humidity});
+}
+
+void Replay::set_active_scan(bool enabled) {
+    active_scan_changes.push_back({now, enabled});
+}
+
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "ingest.h"
+
+namespace Ingest {
+
+// Runs captured advertisements through a private Gateway.  The clock is driven
+// by the record timestamps instead of the wall clock, so a replay gives the same
+// results at any speed.  Nothing leaves the sandbox: publications, name changes
+// and active scan switches are only recorded.
+class Replay: public Environment {
+    public:
+        struct Publication {
+            uint32_t timestamp;
+            Address address;
+            std::string name;       // empty if the device had no name yet
+            double temperature;
+            double humidity;
+
+            bool operator==(const Publication & other) const {
+                return (timestamp == other.timestamp) && (address == other.address) && (name == other.name)
+                       && (temperature == other.temperature) && (humidity == other.humidity);
+            }
+        };
+
+        struct ActiveScanChange {
+            uint32_t timestamp;
+            bool enabled;
+
+            bool operator==(const ActiveScanChange & other) const {
+                return (timestamp == other.timestamp) && (enabled == other.enabled);
+            }
+        };
+
+        Replay(): gateway(*this), now(0) {}
+
+        // Advances the clock to the record's timestamp and processes it, giving
+        // the gateway a chance to publish before and after, like loop() would.
+        void feed(const Advertisement & advertisement);
+
+        // Advances the clock without new advertisements.
+        void advance(uint32_t timestamp);
+
+        uint32_t millis() override { return now; }
+
+        const char * get_name(const Address & address) override;
+        void set_name(const Address & address, const std::string & name) override;
+
+        void publish(const Address & address, const char * name, const Reading & reading) override;
+        void set_active_scan(bool enabled) override;
+
+        void log(const char * message) override {}
+        void debug(const char * message) override {}
+
+        Gateway gateway;
+        std::map<Address, std::string> names;
+        std::vector<Publication> publications;
+        std::vector<ActiveScanChange> active_scan_changes;
+
+    protected:
+        uint32_t now;
+};
+
+}
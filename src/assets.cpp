@@ -0,0 +1,147 @@
+#include <map>
+#include <vector>
+
+#include <SPIFFS.h>
+
+#include <ArduinoJson.h>
+#include <PicoSyslog.h>
+#include <PicoUtils.h>
+
+#include "assets.h"
+
+extern PicoSyslog::Logger syslog;
+
+namespace {
+
+const char MANIFEST_PATH[] PROGMEM = "/html/assets.json";
+const char CACHE_CONTROL[] PROGMEM = "max-age=86400";
+
+// Gzipped assets up to this size are kept in RAM after the first request,
+// larger ones are streamed from SPIFFS every time.
+const size_t MAX_CACHED_SIZE = 8 * 1024;
+
+struct Asset {
+    String path;
+    String etag;
+    const char * content_type;
+    std::vector<uint8_t> data;
+    bool cached;
+};
+
+std::map<String, Asset> assets;
+
+const char * get_content_type(const String & name) {
+    if (name.endsWith(".html")) {
+        return "text/html";
+    } else if (name.endsWith(".css")) {
+        return "text/css";
+    } else if (name.endsWith(".js")) {
+        return "application/javascript";
+    } else if (name.endsWith(".json")) {
+        return "application/json";
+    } else if (name.endsWith(".png")) {
+        return "image/png";
+    } else if (name.endsWith(".ico")) {
+        return "image/x-icon";
+    } else if (name.endsWith(".svg")) {
+        return "image/svg+xml";
+    } else {
+        return "application/octet-stream";
+    }
+}
+
+void load(Asset & asset) {
+    auto file = SPIFFS.open(asset.path, "r");
+    if (!file) {
+        return;
+    }
+
+    const size_t size = file.size();
+    if (size <= MAX_CACHED_SIZE) {
+        asset.data.resize(size);
+        if (file.read(asset.data.data(), size) == size) {
+            asset.cached = true;
+        } else {
+            asset.data.clear();
+        }
+    }
+    file.close();
+}
+
+void send_cache_headers(WebServer & server, const Asset & asset) {
+    server.sendHeader(F("ETag"), asset.etag);
+    server.sendHeader(F("Cache-Control"), FPSTR(CACHE_CONTROL));
+}
+
+void serve(WebServer & server, Asset & asset) {
+    const String if_none_match = server.header(F("If-None-Match"));
+    if ((if_none_match == "*") || (if_none_match.indexOf(asset.etag) >= 0)) {
+        send_cache_headers(server, asset);
+        server.send(304);
+        return;
+    }
+
+    if (!asset.cached) {
+        load(asset);
+    }
+
+    if (asset.cached) {
+        send_cache_headers(server, asset);
+        server.sendHeader(F("Content-Encoding"), F("gzip"));
+        server.send_P(200, asset.content_type, (const char *) asset.data.data(), asset.data.size());
+        return;
+    }
+
+    auto file = SPIFFS.open(asset.path, "r");
+    if (!file) {
+        server.send(404, "text/plain", "Not found");
+        return;
+    }
+
+    // streamFile() adds Content-Encoding: gzip itself for .gz files
+    send_cache_headers(server, asset);
+    server.streamFile(file, asset.content_type);
+    file.close();
+}
+
+}
+
+namespace StaticAssets {
+
+void init(WebServer & server) {
+    static const char * collected_headers[] = {"If-None-Match"};
+    server.collectHeaders(collected_headers, 1);
+
+    PicoUtils::JsonConfigFile<JsonDocument> manifest(SPIFFS, FPSTR(MANIFEST_PATH));
+    for (auto kv : manifest.as<JsonObject>()) {
+        const String name = kv.key().c_str();
+        const String hash = kv.value().as<const char *>();
+
+        if (hash.length() == 0) {
+            continue;
+        }
+
+        auto & asset = assets[name];
+        asset.path = "/html/" + name + ".gz";
+        asset.etag = "\"" + hash + "\"";
+        asset.content_type = get_content_type(name);
+        asset.cached = false;
+
+        server.on("/" + name, HTTP_GET, [&server, &asset] { serve(server, asset); });
+    }
+
+    if (assets.empty()) {
+        // filesystem image predates the manifest, serve the files as they are
+        syslog.println(F("Static asset manifest missing, serving files directly."));
+        server.serveStatic("/", SPIFFS, "/html/", CACHE_CONTROL);
+        return;
+    }
+
+    const auto index = assets.find("index.html");
+    if (index != assets.end()) {
+        auto & asset = index->second;
+        server.on("/", HTTP_GET, [&server, &asset] { serve(server, asset); });
+    }
+}
+
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WebServer.h>
+
+namespace StaticAssets {
+
+void init(WebServer & server);
+
+}
@@ -0,0 +1,403 @@
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <SPIFFS.h>
+
+#include <ArduinoJson.h>
+#include <PicoSyslog.h>
+#include <PicoUtils.h>
+#include <capture_file.h>
+#include <replay.h>
+
+#include "capture.h"
+#include "globals.h"
+
+extern PicoSyslog::Logger syslog;
+
+namespace {
+
+const char CAPTURE_PATH[] PROGMEM = "/capture.bin";
+
+// The capture file is a ring of fixed size records, 16 kB in total.
+const uint16_t CAPACITY = 256;
+const size_t MAX_CAPTURE_SIZE = sizeof(Ingest::CaptureHeader) + CAPACITY * sizeof(Ingest::Advertisement);
+
+// Received advertisements are buffered in RAM and written out periodically.
+const unsigned long FLUSH_INTERVAL_MILLIS = 5 * 1000;
+const size_t MAX_PENDING = CAPACITY;
+
+// Upper bound of advertisements replayed in a single tick.
+const unsigned int MAX_REPLAY_BATCH = 32;
+
+// Read by record() in the BLE task.
+std::atomic<bool> capture_enabled(false);
+std::vector<Ingest::Advertisement> pending;
+unsigned int dropped;
+PicoUtils::Stopwatch last_flush;
+
+// Replays run in a sandbox, they never touch the live readings, names or publishers.
+struct {
+    std::unique_ptr<Ingest::Replay> sandbox;
+    bool active;
+    double speed;
+    fs::File file;
+    Ingest::CaptureHeader header;
+    uint32_t index;
+    uint32_t total;
+    uint32_t first_timestamp;
+    unsigned long start_millis;
+    Ingest::Advertisement next;
+    bool have_next;
+} replay;
+
+struct {
+    fs::File file;
+    size_t size;
+    String error;
+} upload;
+
+bool read_header(fs::File & file, Ingest::CaptureHeader & header) {
+    return file.seek(0)
+           && (file.read((uint8_t *) &header, sizeof(header)) == sizeof(header))
+           && Ingest::is_valid(header);
+}
+
+void flush() {
+    std::vector<Ingest::Advertisement> records;
+    unsigned int records_dropped;
+
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        records.swap(pending);
+        records_dropped = dropped;
+        dropped = 0;
+    }
+
+    last_flush.reset();
+
+    if (records_dropped) {
+        syslog.printf("Capture buffer overflow, dropped %u advertisements.\n", records_dropped);
+    }
+
+    if (records.empty()) {
+        return;
+    }
+
+    auto file = SPIFFS.open(FPSTR(CAPTURE_PATH), "r+");
+    Ingest::CaptureHeader header;
+    if (!file || !read_header(file, header)) {
+        syslog.println(F("Capture file missing or invalid, stopping capture."));
+        capture_enabled = false;
+        return;
+    }
+
+    for (const auto & record : records) {
+        file.seek(Ingest::get_append_offset(header));
+        file.write((const uint8_t *) &record, sizeof(record));
+        ++header.count;
+    }
+
+    file.seek(0);
+    file.write((const uint8_t *) &header, sizeof(header));
+    file.close();
+}
+
+bool start_capture() {
+    auto file = SPIFFS.open(FPSTR(CAPTURE_PATH), "w");
+    if (!file) {
+        return false;
+    }
+
+    Ingest::CaptureHeader header;
+    header.magic = Ingest::CAPTURE_MAGIC;
+    header.version = Ingest::CAPTURE_VERSION;
+    header.record_size = sizeof(Ingest::Advertisement);
+    header.capacity = CAPACITY;
+    header.count = 0;
+    const bool success = (file.write((const uint8_t *) &header, sizeof(header)) == sizeof(header));
+    file.close();
+
+    if (success) {
+        std::lock_guard<std::mutex> guard(mutex);
+        pending.clear();
+        dropped = 0;
+        capture_enabled = true;
+        last_flush.reset();
+    }
+
+    return success;
+}
+
+void stop_capture() {
+    if (!capture_enabled) {
+        return;
+    }
+    flush();
+    capture_enabled = false;
+}
+
+void stop_replay() {
+    if (!replay.active) {
+        return;
+    }
+    replay.file.close();
+    replay.active = false;
+    syslog.printf("Replay finished after %u of %u advertisements.\n", replay.index, replay.total);
+}
+
+bool read_replay_record(Ingest::Advertisement & record) {
+    return replay.file.seek(Ingest::get_record_offset(replay.header, replay.index))
+           && (replay.file.read((uint8_t *) &record, sizeof(record)) == sizeof(record));
+}
+
+bool start_replay(double speed) {
+    stop_capture();
+    stop_replay();
+
+    replay.file = SPIFFS.open(FPSTR(CAPTURE_PATH), "r");
+    if (!replay.file || !read_header(replay.file, replay.header)) {
+        replay.file.close();
+        return false;
+    }
+
+    replay.sandbox.reset(new Ingest::Replay());
+    replay.total = Ingest::get_record_count(replay.header);
+    replay.index = 0;
+    replay.speed = speed;
+    replay.have_next = (replay.total > 0) && read_replay_record(replay.next);
+    replay.first_timestamp = replay.next.timestamp;
+    replay.start_millis = millis();
+    replay.active = true;
+
+    syslog.printf("Replaying %u advertisements at speed %.2f.\n", replay.total, speed);
+
+    return true;
+}
+
+void replay_tick() {
+    for (unsigned int i = 0; (i < MAX_REPLAY_BATCH) && replay.have_next; ++i) {
+        // pacing only, the sandbox clock follows the record timestamps
+        if (replay.speed > 0) {
+            const double due_millis = (replay.next.timestamp - replay.first_timestamp) / replay.speed;
+            if (due_millis > millis() - replay.start_millis) {
+                return;
+            }
+        }
+
+        replay.sandbox->feed(replay.next);
+
+        ++replay.index;
+        replay.have_next = (replay.index < replay.total) && read_replay_record(replay.next);
+    }
+
+    if (!replay.have_next) {
+        stop_replay();
+    }
+}
+
+JsonDocument get_replay_status() {
+    JsonDocument json;
+    json["active"] = replay.active;
+
+    if (replay.sandbox) {
+        const auto & sandbox = *replay.sandbox;
+        json["replayed"] = replay.index;
+        json["total"] = replay.total;
+        json["readings"] = sandbox.gateway.get_readings().size();
+        json["names"] = sandbox.names.size();
+        json["publications"] = sandbox.publications.size();
+        json["active_scan_changes"] = sandbox.active_scan_changes.size();
+    }
+
+    return json;
+}
+
+void send_capture(WebServer & server) {
+    if (capture_enabled) {
+        flush();
+    }
+
+    auto file = SPIFFS.open(FPSTR(CAPTURE_PATH), "r");
+    if (!file) {
+        server.send(404, "text/plain", "No capture");
+        return;
+    }
+
+    server.sendHeader(F("Content-Disposition"), F("attachment; filename=\"capture.bin\""));
+    server.streamFile(file, "application/octet-stream");
+    file.close();
+}
+
+void abort_upload(const char * error) {
+    if (upload.file) {
+        upload.file.close();
+    }
+    SPIFFS.remove(FPSTR(CAPTURE_PATH));
+    upload.error = error;
+}
+
+void validate_upload() {
+    auto file = SPIFFS.open(FPSTR(CAPTURE_PATH), "r");
+    Ingest::CaptureHeader header;
+    const bool valid = file && read_header(file, header)
+                       && (header.capacity <= CAPACITY)
+                       && (file.size() == Ingest::get_capture_size(header));
+    file.close();
+
+    if (!valid) {
+        abort_upload("Invalid capture file");
+    }
+}
+
+void receive_capture(WebServer & server) {
+    HTTPUpload & http_upload = server.upload();
+    switch (http_upload.status) {
+        case UPLOAD_FILE_START:
+            stop_capture();
+            stop_replay();
+            upload.size = 0;
+            upload.error = "";
+            upload.file = SPIFFS.open(FPSTR(CAPTURE_PATH), "w");
+            if (!upload.file) {
+                upload.error = "Error creating capture file";
+            }
+            break;
+        case UPLOAD_FILE_WRITE:
+            if (!upload.error.isEmpty()) {
+                break;
+            }
+            upload.size += http_upload.currentSize;
+            if (upload.size > MAX_CAPTURE_SIZE) {
+                abort_upload("Capture file too large");
+                break;
+            }
+            upload.file.write(http_upload.buf, http_upload.currentSize);
+            break;
+        case UPLOAD_FILE_END:
+            if (upload.error.isEmpty()) {
+                upload.file.close();
+                validate_upload();
+            }
+            break;
+        case UPLOAD_FILE_ABORTED:
+            if (upload.error.isEmpty()) {
+                abort_upload("Upload aborted");
+            }
+            break;
+    }
+}
+
+}
+
+namespace Capture {
+
+Ingest::Advertisement convert(BLEAdvertisedDevice & device) {
+    static const BLEUUID THERMOMETHER_UUID{(uint16_t) 0x181a};
+
+    Ingest::Advertisement advertisement;
+    memset(&advertisement, 0, sizeof(advertisement));
+
+    advertisement.timestamp = millis();
+    memcpy(advertisement.address, *device.getAddress().getNative(), sizeof(advertisement.address));
+    advertisement.rssi = device.haveRSSI() ? device.getRSSI() : 0;
+
+    if (device.haveName()) {
+        const std::string name = device.getName().c_str();
+        advertisement.flags |= Ingest::Advertisement::HAVE_NAME;
+        advertisement.name_length = std::min<size_t>(name.length(), sizeof(advertisement.name));
+        memcpy(advertisement.name, name.c_str(), advertisement.name_length);
+    }
+
+    for (int i = 0; i < device.getServiceDataUUIDCount(); ++i) {
+        if (!device.getServiceDataUUID(i).equals(THERMOMETHER_UUID)) {
+            continue;
+        }
+
+        const auto raw_data = device.getServiceData();
+        advertisement.flags |= Ingest::Advertisement::HAVE_THERMOMETER_DATA;
+        advertisement.data_length = std::min<size_t>(raw_data.length(), sizeof(advertisement.data));
+        memcpy(advertisement.data, raw_data.c_str(), advertisement.data_length);
+        break;
+    }
+
+    return advertisement;
+}
+
+void init(WebServer & server) {
+    server.on("/capture", HTTP_GET, [&server] { send_capture(server); });
+
+    server.on("/capture", HTTP_POST, [&server] {
+        stop_replay();
+        if (start_capture()) {
+            syslog.println(F("Advertisement capture started."));
+            server.send(200, "text/plain", "OK");
+        } else {
+            server.send(500, "text/plain", "Error creating capture file");
+        }
+    });
+
+    server.on("/capture", HTTP_DELETE, [&server] {
+        stop_capture();
+        syslog.println(F("Advertisement capture stopped."));
+        server.send(200, "text/plain", "OK");
+    });
+
+    server.on("/capture", HTTP_PUT, [&server] {
+        if (upload.error.isEmpty()) {
+            server.send(200, "text/plain", "OK");
+        } else {
+            server.send(400, "text/plain", upload.error);
+        }
+    }, [&server] { receive_capture(server); });
+
+    server.on("/capture/replay", HTTP_POST, [&server] {
+        const double speed = server.hasArg("speed") ? server.arg("speed").toDouble() : 1.0;
+        if (start_replay(speed)) {
+            server.send(200, "text/plain", "OK");
+        } else {
+            server.send(404, "text/plain", "No valid capture");
+        }
+    });
+
+    server.on("/capture/replay", HTTP_GET, [&server] {
+        String response;
+        serializeJson(get_replay_status(), response);
+        server.send(200, "application/json", response);
+    });
+
+    server.on("/capture/replay", HTTP_DELETE, [&server] {
+        stop_replay();
+        replay.sandbox.reset();
+        server.send(200, "text/plain", "OK");
+    });
+}
+
+void tick() {
+    if (capture_enabled && (last_flush.elapsed_millis() >= FLUSH_INTERVAL_MILLIS)) {
+        flush();
+    }
+
+    if (replay.active) {
+        replay_tick();
+    }
+}
+
+void record(const Ingest::Advertisement & advertisement) {
+    if (!capture_enabled) {
+        return;
+    }
+
+    if (pending.size() >= MAX_PENDING) {
+        ++dropped;
+        return;
+    }
+
+    pending.push_back(advertisement);
+}
+
+bool capturing() {
+    return capture_enabled;
+}
+
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <Arduino.h>
+#include <BLEDevice.h>
+#include <WebServer.h>
+
+#include <ingest.h>
+
+namespace Capture {
+
+Ingest::Advertisement convert(BLEAdvertisedDevice & device);
+
+void init(WebServer & server);
+void tick();
+
+// Must be called with the global mutex held.
+void record(const Ingest::Advertisement & advertisement);
+
+bool capturing();
+
+}
@@ -1,156 +1,228 @@
 #include <map>
 #include <set>
 
-#include <BLEDevice.h>
-
-#include <ArduinoJson.h>
 #include <PicoUtils.h>
 #include <PicoSyslog.h>
+#include <ingest.h>
 
 #include "hass.h"
 #include "globals.h"
-#include "readings.h"
+#include "names.h"
 
 extern "C" uint8_t temprature_sens_read();
 
 extern String hostname;
 extern PicoSyslog::SimpleLogger syslog;
-extern std::map<BLEAddress, Readings> readings;
-extern std::map<BLEAddress, String> names;
+extern Ingest::Gateway gateway;
+extern Names names;
 extern PicoMQTT::Client mqtt;
 
 namespace {
 
+// Home Assistant discovery configs are mostly constant text, so they are
+// pre-rendered at compile time.  The few dynamic values are marked with
+// placeholder bytes and spliced in while streaming the payload.
+#define HASS_DEVICE_ID "\x01"
+#define HASS_DEVICE_NAME "\x02"
+#define HASS_DEVICE_MAC "\x03"
+#define HASS_BOARD_ID "\x04"
+#define HASS_HOSTNAME "\x05"
+#define HASS_WIFI_MAC "\x06"
+#define HASS_IP "\x07"
+#define HASS_AVAILABILITY_TOPIC "\x08"
+
+#define HASS_PRECISION(p) ",\"suggested_display_precision\":" #p
+#define HASS_DEVICE_CLASS(c) ",\"device_class\":\"" c "\""
+#define HASS_UNIT(u) ",\"unit_of_measurement\":\"" u "\""
+#define HASS_DIAGNOSTIC ",\"entity_category\":\"diagnostic\""
+
+#define HASS_SENSOR_CONFIG(id, friendly_name, extra) \
+    "{\"unique_id\":\"kelvin_" HASS_DEVICE_ID "_" id "\"" \
+    ",\"object_id\":\"kelvin_" HASS_DEVICE_NAME "_" id "\"" \
+    ",\"name\":\"" friendly_name "\"" \
+    ",\"expire_after\":180" \
+    ",\"state_topic\":\"kelvin/" HASS_DEVICE_ID "/" id "\"" \
+    extra \
+    ",\"device\":{\"name\":\"" HASS_DEVICE_NAME "\",\"manufacturer\":\"Xiaomi\",\"model\":\"LYWSD03MMC\"" \
+    ",\"identifiers\":[\"" HASS_DEVICE_ID "\"]" \
+    ",\"connections\":[[\"mac\",\"" HASS_DEVICE_MAC "\"]]" \
+    ",\"via_device\":\"kelvin_" HASS_BOARD_ID "\"}}"
+
+#define HASS_BOARD_CONFIG(id, friendly_name, extra) \
+    "{\"unique_id\":\"kelvin_" HASS_BOARD_ID "_" id "\"" \
+    ",\"object_id\":\"kelvin_" HASS_HOSTNAME "_" id "\"" \
+    ",\"name\":\"" friendly_name "\"" \
+    ",\"state_topic\":\"kelvin/" HASS_BOARD_ID "/" id "\"" \
+    ",\"availability_topic\":\"" HASS_AVAILABILITY_TOPIC "\"" \
+    extra \
+    HASS_DIAGNOSTIC \
+    ",\"device\":{\"name\":\"" HASS_HOSTNAME "\",\"manufacturer\":\"mlesniew\",\"model\":\"Kelvin\"" \
+    ",\"identifiers\":[\"kelvin_" HASS_BOARD_ID "\"]" \
+    ",\"connections\":[[\"mac\",\"" HASS_WIFI_MAC "\"],[\"ip\",\"" HASS_IP "\"]]" \
+    ",\"sw_version\":\"" __DATE__ " " __TIME__ "\"" \
+    ",\"configuration_url\":\"http://" HASS_IP "\"}}"
+
 struct Entity {
     const char * name;
-    const char * friendly_name;
-    const char * unit;
-    int precission;
     bool binary;
-    bool diagnostic;
-    const char * device_class;
+    const char * config;
 };
 
-void autodiscovery(BLEAddress address, String name) {
+// Writes (or only measures, if out is null) a JSON string body with escaping.
+size_t write_escaped(Print * out, const char * str) {
+    static const char HEX_DIGITS[] = "0123456789abcdef";
+
+    size_t length = 0;
+    for (; *str; ++str) {
+        const unsigned char c = *str;
+        if ((c == '"') || (c == '\\')) {
+            if (out) {
+                out->write('\\');
+                out->write(c);
+            }
+            length += 2;
+        } else if (c < 0x20) {
+            if (out) {
+                out->print("\\u00");
+                out->write(HEX_DIGITS[c >> 4]);
+                out->write(HEX_DIGITS[c & 0xf]);
+            }
+            length += 6;
+        } else {
+            if (out) {
+                out->write(c);
+            }
+            length += 1;
+        }
+    }
+    return length;
+}
+
+// Expands a pre-rendered config, replacing placeholder byte N with slots[N - 1].
+// Returns the payload length; nothing is written if out is null.
+size_t render(Print * out, const char * config, const char * const slots[]) {
+    size_t length = 0;
+    while (*config) {
+        const char * literal_end = config;
+        while ((unsigned char)(*literal_end) >= 0x20) {
+            ++literal_end;
+        }
+
+        if (literal_end != config) {
+            const size_t literal_length = literal_end - config;
+            if (out) {
+                out->write((const uint8_t *) config, literal_length);
+            }
+            length += literal_length;
+            config = literal_end;
+        } else {
+            length += write_escaped(out, slots[*config - 1]);
+            ++config;
+        }
+    }
+    return length;
+}
+
+void publish_config(const String & topic, const char * config, const char * const slots[]) {
+    auto publish = HomeAssistant::mqtt.begin_publish(topic, render(nullptr, config, slots), 0, true);
+    render(&publish, config, slots);
+    publish.send();
+}
+
+void autodiscovery(const Ingest::Address & address, const String & name) {
     if (!HomeAssistant::autodiscovery_topic.length()) {
         return;
     }
 
     syslog.printf("Sending Home Assistant autodiscovery for device %s (%s).\n",
-                  address.toString().c_str(), name.c_str());
+                  Ingest::to_string(address).c_str(), name.c_str());
 
     static const Entity entities[] = {
-        {"temperature", "Temperature", "°C", 1, false, false, "temperature"},
-        {"humidity", "Humidity", "%", 1, false, false, "humidity"},
-        {"battery_level", "Battery level", "%", 0, false, true, "battery"},
-        {"battery_voltage", "Battery voltage", "V", 2, false, true, "voltage"},
+        {
+            "temperature", false, HASS_SENSOR_CONFIG("temperature", "Temperature",
+                    HASS_PRECISION(1) HASS_DEVICE_CLASS("temperature") HASS_UNIT("°C"))
+        },
+        {
+            "humidity", false, HASS_SENSOR_CONFIG("humidity", "Humidity",
+                    HASS_PRECISION(1) HASS_DEVICE_CLASS("humidity") HASS_UNIT("%"))
+        },
+        {
+            "battery_level", false, HASS_SENSOR_CONFIG("battery_level", "Battery level",
+                    HASS_PRECISION(0) HASS_DEVICE_CLASS("battery") HASS_UNIT("%") HASS_DIAGNOSTIC)
+        },
+        {
+            "battery_voltage", false, HASS_SENSOR_CONFIG("battery_voltage", "Battery voltage",
+                    HASS_PRECISION(2) HASS_DEVICE_CLASS("voltage") HASS_UNIT("V") HASS_DIAGNOSTIC)
+        },
     };
 
-    const String mac = address.toString().c_str();
+    const String mac = Ingest::to_string(address).c_str();
     String dev_addr_without_colons = mac;
     dev_addr_without_colons.replace(":", "");
+    const String board_id = get_board_id();
 
-    for (const auto & entity : entities) {
-        auto unique_id = "kelvin_" + dev_addr_without_colons + "_" + entity.name;
-
-        const String topic = HomeAssistant::autodiscovery_topic + "/sensor/" + unique_id + "/config";
-
-        JsonDocument json;
-        json["unique_id"] = unique_id;
-        json["object_id"] = "kelvin_" + name + "_" + entity.name;
-        json["name"] = entity.friendly_name;
-        json["device_class"] = entity.device_class;
-        json["expire_after"] = 60 * 3;
-        json["suggested_display_precision"] = entity.precission;
-        json["state_topic"] = "kelvin/" + dev_addr_without_colons + "/" + entity.name;
-        json["unit_of_measurement"] = entity.unit;
-        if (entity.diagnostic) {
-            json["entity_category"] = "diagnostic";
-        }
+    const char * const slots[] = {
+        dev_addr_without_colons.c_str(),
+        name.c_str(),
+        mac.c_str(),
+        board_id.c_str(),
+    };
 
-        auto dev = json["device"].to<JsonObject>();
-        dev["name"] = name;
-        dev["manufacturer"] = "Xiaomi";
-        dev["model"] = "LYWSD03MMC";
-        dev["identifiers"][0] = dev_addr_without_colons;
-        dev["connections"][0][0] = "mac";
-        dev["connections"][0][1] = mac;
-        dev["via_device"] = "kelvin_" + get_board_id();
-
-        auto publish = HomeAssistant::mqtt.begin_publish(topic, measureJson(json), 0, true);
-        serializeJson(json, publish);
-        publish.send();
+    for (const auto & entity : entities) {
+        const String topic = HomeAssistant::autodiscovery_topic + "/sensor/kelvin_" + dev_addr_without_colons + "_" +
+                             entity.name + "/config";
+        publish_config(topic, entity.config, slots);
     }
 
 }
 
-void autodiscovery(BLEAddress address) {
-    const auto it = names.find(address);
-    if (it != names.end()) {
-        autodiscovery(address, it->second);
+void autodiscovery(const Ingest::Address & address) {
+    const char * name = names[address];
+    if (name) {
+        autodiscovery(address, name);
     }
 }
 
 void autodiscovery() {
-    for (const auto & kv : readings) {
+    const unsigned long start = micros();
+
+    for (const auto & kv : gateway.get_readings()) {
         autodiscovery(kv.first);
     }
 
     static const Entity entities[] = {
-        {"rssi", "WiFi RSSI", "dBm", 0, false, true, "signal_strength"},
-        {"uptime", "Uptime", "s", 0, false, true, "duration"},
-        {"free_heap", "Free Heap", "kB", 0, false, true, "data_size"},
-        {"temperature", "Temperature", "°C", 0, false, true, "temperature"},
-        {"mqtt_connection", "MQTT", nullptr, 0, true, true, "connectivity"},
-        {"connected_devices", "Connected devices", "devices", 0, false, true, nullptr},
-        {"known_devices", "Known devices", "devices", 0, false, true, nullptr},
+        {"rssi", false, HASS_BOARD_CONFIG("rssi", "WiFi RSSI", HASS_PRECISION(0) HASS_DEVICE_CLASS("signal_strength") HASS_UNIT("dBm"))},
+        {"uptime", false, HASS_BOARD_CONFIG("uptime", "Uptime", HASS_PRECISION(0) HASS_DEVICE_CLASS("duration") HASS_UNIT("s"))},
+        {"free_heap", false, HASS_BOARD_CONFIG("free_heap", "Free Heap", HASS_PRECISION(0) HASS_DEVICE_CLASS("data_size") HASS_UNIT("kB"))},
+        {"temperature", false, HASS_BOARD_CONFIG("temperature", "Temperature", HASS_PRECISION(0) HASS_DEVICE_CLASS("temperature") HASS_UNIT("°C"))},
+        {"mqtt_connection", true, HASS_BOARD_CONFIG("mqtt_connection", "MQTT", HASS_DEVICE_CLASS("connectivity"))},
+        {"connected_devices", false, HASS_BOARD_CONFIG("connected_devices", "Connected devices", HASS_PRECISION(0) HASS_UNIT("devices"))},
+        {"known_devices", false, HASS_BOARD_CONFIG("known_devices", "Known devices", HASS_PRECISION(0) HASS_UNIT("devices"))},
     };
 
-    for (const auto & entity : entities) {
-        JsonDocument json;
-
-        auto unique_id = "kelvin_" + get_board_id() + "_" + entity.name;
-        const String topic = HomeAssistant::autodiscovery_topic + (entity.binary ? "/binary_sensor/" : "/sensor/") + unique_id +
-                             "/config";
-
-        json["unique_id"] = unique_id;
-        json["object_id"] = "kelvin_" + hostname + "_" + entity.name;
-        json["name"] = entity.friendly_name;
-        json["state_topic"] = "kelvin/" + get_board_id() + "/" + entity.name;
-        json["availability_topic"] = HomeAssistant::mqtt.will.topic;
-
-        if (!entity.binary) {
-            json["suggested_display_precision"] = entity.precission;
-        }
-
-        if (entity.device_class) {
-            json["device_class"] = entity.device_class;
-        }
-
-        if (entity.unit) {
-            json["unit_of_measurement"] = entity.unit;
-        }
-
-        if (entity.diagnostic) {
-            json["entity_category"] = "diagnostic";
-        }
+    const String board_id = get_board_id();
+    const String wifi_mac = WiFi.macAddress();
+    const String ip = WiFi.localIP().toString();
+
+    const char * const slots[] = {
+        nullptr,
+        nullptr,
+        nullptr,
+        board_id.c_str(),
+        hostname.c_str(),
+        wifi_mac.c_str(),
+        ip.c_str(),
+        HomeAssistant::mqtt.will.topic.c_str(),
+    };
 
-        auto dev = json["device"].to<JsonObject>();
-        dev["name"] = hostname;
-        dev["manufacturer"] = "mlesniew";
-        dev["model"] = "Kelvin";
-        dev["identifiers"][0] = "kelvin_" + get_board_id();
-        dev["connections"][0][0] = "mac";
-        dev["connections"][0][1] = WiFi.macAddress();
-        dev["connections"][1][0] = "ip";
-        dev["connections"][1][1] = WiFi.localIP();
-        dev["sw_version"] = __DATE__ " " __TIME__;
-        dev["configuration_url"] = String("http://") + WiFi.localIP().toString();
-
-        auto publish = HomeAssistant::mqtt.begin_publish(topic, measureJson(json), 0, true);
-        serializeJson(json, publish);
-        publish.send();
+    for (const auto & entity : entities) {
+        const String topic = HomeAssistant::autodiscovery_topic + (entity.binary ? "/binary_sensor/" : "/sensor/") +
+                             "kelvin_" + board_id + "_" + entity.name + "/config";
+        publish_config(topic, entity.config, slots);
     }
+
+    syslog.printf("Home Assistant autodiscovery for %u devices took %lu us.\n",
+                  (unsigned int) gateway.get_readings().size(), micros() - start);
 }
 
 }
@@ -167,8 +239,9 @@ void publish_diagnostics() {
     mqtt.publish("kelvin/" + get_board_id() + "/temperature", String((double(temprature_sens_read()) - 32) / 1.8));
     mqtt.publish("kelvin/" + get_board_id() + "/mqtt_connection", ::mqtt.connected() ? "ON" : "OFF");
 
+    const auto & readings = gateway.get_readings();
     const size_t devices = std::count_if(readings.begin(),
-    readings.end(), [](const std::pair<const BLEAddress, Readings> & p) { return p.second.age.elapsed_millis() <= 3 * 60 * 1000; });
+    readings.end(), [](const std::pair<const Ingest::Address, Ingest::Reading> & p) { return millis() - p.second.timestamp <= 3 * 60 * 1000; });
     mqtt.publish("kelvin/" + get_board_id() + "/connected_devices", String(devices));
     mqtt.publish("kelvin/" + get_board_id() + "/known_devices", String(names.size()));
 }
@@ -198,7 +271,7 @@ void init() {
 
 void tick() {
     static PicoUtils::Stopwatch last_update;
-    static std::set<BLEAddress> discovered_devices;
+    static std::set<Ingest::Address> discovered_devices;
 
     mqtt.loop();
 
@@ -212,22 +285,22 @@ void tick() {
 
     publish_diagnostics();
 
-    for (const auto & kv : readings) {
-        auto address = kv.first;
+    for (const auto & kv : gateway.get_readings()) {
+        const auto & address = kv.first;
         const auto & reading = kv.second;
 
-        if (reading.age.elapsed() > last_update.elapsed()) {
+        if (millis() - reading.timestamp > last_update.elapsed_millis()) {
             continue;
         }
 
-        const auto it = names.find(address);
+        const char * name = names[address];
 
-        if ((it != names.end()) && (discovered_devices.count(address) == 0)) {
-            autodiscovery(address, it->second);
+        if (name && (discovered_devices.count(address) == 0)) {
+            autodiscovery(address, name);
             discovered_devices.insert(address);
         }
 
-        String dev_addr = address.toString().c_str();
+        String dev_addr = Ingest::to_string(address).c_str();
         dev_addr.replace(":", "");
 
         mqtt.publish("kelvin/" + dev_addr + "/temperature", String(reading.temperature));
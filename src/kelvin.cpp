@@ -1,3 +1,4 @@
+#include <atomic>
 #include <mutex>
 #include <map>
 
@@ -15,11 +16,14 @@
 #include <PicoSyslog.h>
 #include <PicoUtils.h>
 #include <WiFiManager.h>
+#include <ingest.h>
 
+#include "assets.h"
+#include "capture.h"
 #include "globals.h"
 #include "hass.h"
-#include "readings.h"
 #include "names.h"
+#include "network_config.h"
 
 PicoUtils::PinInput button(0, true);
 PicoUtils::PinOutput wifi_led(2, false);
@@ -32,157 +36,109 @@ PicoMQ picomq;
 PicoMQTT::Client mqtt;
 PicoSyslog::Logger syslog("kelvin");
 
-std::map<BLEAddress, Readings> readings;
-
-bool active_scan_enabled;
-PicoUtils::Stopwatch active_scan_stopwatch;
-PicoUtils::Stopwatch last_mqtt_reconnect;
 PicoUtils::WiFiControlSmartConfig wifi_control(wifi_led);
 
 Names names;
 PicoUtils::Stopwatch last_name_save;
 
+// Boot timing, first_reading_millis is set from the BLE task.
+std::atomic<unsigned long> first_reading_millis(0);
+std::atomic<unsigned long> first_publish_millis(0);
+
+// Networking is brought up one stage per loop() iteration, while BLE ingest is already running.
+enum class NetworkStage { wifi, web_server, mqtt, home_assistant, ota, ready };
+NetworkStage network_stage = NetworkStage::wifi;
+
+// Set once the Wi-Fi stack is initialized, syslog can't send anything before that.
+std::atomic<bool> wifi_initialized(false);
+
+Print & logger() {
+    if (wifi_initialized) {
+        return syslog;
+    } else {
+        return Serial;
+    }
+}
+
 static const unsigned char ADDRESS_PREFIX[] = {0xa4, 0xc1, 0x38};
 
-class ScanCallbacks: public BLEAdvertisedDeviceCallbacks {
+void restart_scan(bool active);
+
+class LiveEnvironment: public Ingest::Environment {
     public:
-        static bool active_scan_required;
+        uint32_t millis() override {
+            return ::millis();
+        }
 
-        void onResult(BLEAdvertisedDevice advertisedDevice) override {
-            std::lock_guard<std::mutex> guard(mutex);
+        const char * get_name(const Ingest::Address & address) override {
+            return names[address];
+        }
 
-            auto address = advertisedDevice.getAddress();
-            if (memcmp(address.getNative(), ADDRESS_PREFIX, 3) != 0) {
-                return;
-            }
+        void set_name(const Ingest::Address & address, const std::string & name) override {
+            names.set(address, name.c_str());
+        }
 
-            const String address_str = BLEAddress(address).toString().c_str();
+        void publish(const Ingest::Address & address, const char * name, const Ingest::Reading & reading) override {
+            static const String topic_prefix = "celsius/" + get_board_id() + "/";
 
-            bool have_name = names[address];
-            if (!have_name && advertisedDevice.haveName()) {
-                const String name = advertisedDevice.getName().c_str();
-                if (name.length() > 0) {
-                    syslog.printf("Assigning name %s to %s\n", name.c_str(), address_str.c_str());
-                    names.set(address, name);
-                    have_name = true;
-                }
+            if (name) {
+                picomq.publish(topic_prefix + name + "/temperature", reading.temperature);
+                picomq.publish(topic_prefix + name + "/humidity", reading.humidity);
+                mqtt.publish(topic_prefix + name + "/temperature", String(reading.temperature));
             }
 
-            for (int i = 0; i < advertisedDevice.getServiceDataUUIDCount(); ++i) {
-                static const BLEUUID THERMOMETHER_UUID{(uint16_t) 0x181a};
+            const String address_str = Ingest::to_string(address).c_str();
+            picomq.publish(topic_prefix + address_str + "/temperature", reading.temperature);
+            picomq.publish(topic_prefix + address_str + "/humidity", reading.humidity);
+            mqtt.publish(topic_prefix + address_str + "/temperature", String(reading.temperature));
 
-                if (!advertisedDevice.getServiceDataUUID(i).equals(THERMOMETHER_UUID)) {
-                    continue;
-                }
+            if (!first_publish_millis && mqtt.connected()) {
+                first_publish_millis = ::millis();
+                syslog.printf("Boot timing: first reading after %lu ms, first publish after %lu ms.\n",
+                              first_reading_millis.load(), first_publish_millis.load());
+            }
+        }
 
-                const auto raw_data = advertisedDevice.getServiceData();
-
-                struct {
-                    // uint8_t     size;   // = 18
-                    // uint8_t     uid;    // = 0x16, 16-bit UUID
-                    // uint16_t    UUID;   // = 0x181A, GATT Service 0x181A Environmental Sensing
-                    uint8_t     MAC[6]; // [0] - lo, .. [6] - hi digits
-                    int16_t     temperature;    // x 0.01 degree
-                    uint16_t    humidity;       // x 0.01 %
-                    uint16_t    battery_mv;     // mV
-                    uint8_t     battery_level;  // 0..100 %
-                    uint8_t     counter;        // measurement count
-                    uint8_t     flags;  // GPIO_TRG pin (marking "reset" on circuit board) flags:
-                    // bit0: Reed Switch, input
-                    // bit1: GPIO_TRG pin output value (pull Up/Down)
-                    // bit2: Output GPIO_TRG pin is controlled according to the set parameters
-                    // bit3: Temperature trigger event
-                    // bit4: Humidity trigger event
-                } __attribute__((packed)) data;
-
-                if (sizeof(data) != raw_data.length()) {
-                    continue;
-                }
+        void set_active_scan(bool enabled) override {
+            restart_scan(enabled);
+        }
 
-                memcpy(&data, raw_data.c_str(), sizeof(data));
+        void log(const char * message) override {
+            logger().println(message);
+        }
 
-                const double temperature = 0.01 * (double) data.temperature;
-                const double humidity = 0.01 * (double) data.humidity;
-                const unsigned int battery_level = data.battery_level;
-                const double battery_voltage = 0.001 * (double) data.battery_mv;
+        void debug(const char * message) override {
+            Serial.println(message);
+        }
+} environment;
 
-                const bool first_reading = (readings.count(address) == 0);
-                if (first_reading) {
-                    syslog.printf("Got first reading from %s (%s)\n", address_str.c_str(),
-                                  have_name ? names[address] : "<unknown>");
-                } else {
-                    Serial.printf("Got reading from %s (%s)\n", address_str.c_str(),
-                                  have_name ? names[address] : "<unknown>");
-                }
+Ingest::Gateway gateway(environment);
 
-                if (!have_name && first_reading) {
-                    active_scan_required = true;
-                    syslog.println("Requesting active scan.");
-                }
+class ScanCallbacks: public BLEAdvertisedDeviceCallbacks {
+    public:
+        void onResult(BLEAdvertisedDevice advertisedDevice) override {
+            std::lock_guard<std::mutex> guard(mutex);
+
+            auto address = advertisedDevice.getAddress();
+            if (memcmp(address.getNative(), ADDRESS_PREFIX, 3) != 0) {
+                return;
+            }
 
-                readings[address] = Readings(temperature, humidity, battery_level, battery_voltage);
+            const auto advertisement = Capture::convert(advertisedDevice);
+            Capture::record(advertisement);
+            gateway.process(advertisement);
 
-                break;
+            if (!first_reading_millis && !gateway.get_readings().empty()) {
+                first_reading_millis = millis();
             }
         }
 } scan_callbacks;
 
-bool ScanCallbacks::active_scan_required;
-
-namespace network_config {
-
-const char CONFIG_PATH[] PROGMEM = "/network.json";
-
-void load() {
-    PicoUtils::JsonConfigFile<JsonDocument> config(SPIFFS, FPSTR(CONFIG_PATH));
-    const String default_hostname = "kelvin_" + get_board_id();
-    hostname = config["hostname"] | default_hostname;
-    mqtt.host = config["mqtt"]["server"] | "calor.local";
-    mqtt.port = config["mqtt"]["port"] | 1883;
-    mqtt.username = config["mqtt"]["username"] | "kelvin";
-    mqtt.password = config["mqtt"]["password"] | "harara";
-    syslog.server = config["syslog"] | "192.168.1.100";
-    syslog.host = hostname;
-    ota_password = config["ota_password"] | "";
-    HomeAssistant::mqtt.host = config["hass"]["server"] | "";
-    HomeAssistant::mqtt.port = config["hass"]["port"] | 1883;
-    HomeAssistant::mqtt.username = config["hass"]["username"] | "";
-    HomeAssistant::mqtt.password = config["hass"]["password"] | "";
-    HomeAssistant::autodiscovery_topic = config["hass"]["autodiscovery_topic"] | "homeassistant";
-}
-
-JsonDocument get() {
-    JsonDocument config;
-    config["hostname"] = hostname;
-    config["mqtt"]["host"] = mqtt.host;
-    config["mqtt"]["port"] = mqtt.port;
-    config["mqtt"]["username"] = mqtt.username;
-    config["mqtt"]["password"] = mqtt.password;
-    config["syslog"] = syslog.server;
-    config["ota_password"] = ota_password;
-    config["hass"]["server"] = HomeAssistant::mqtt.host;
-    config["hass"]["port"] = HomeAssistant::mqtt.port;
-    config["hass"]["username"] = HomeAssistant::mqtt.username;
-    config["hass"]["password"] = HomeAssistant::mqtt.password;
-    return config;
-}
-
-void save() {
-    auto file = SPIFFS.open(FPSTR(CONFIG_PATH), "w");
-    auto config = get();
-    serializeJson(config, file);
-    if (file) {
-        file.close();
-    }
-}
-
-}
-
-void restart_scan() {
+void restart_scan(bool active) {
     auto & scan = *BLEDevice::getScan();
     scan.stop();
 
-    scan.setActiveScan(active_scan_enabled);
+    scan.setActiveScan(active);
     scan.setInterval(100);
     scan.setWindow(99);
 
@@ -213,138 +169,128 @@ void setup() {
     button.init();
 
     SPIFFS.begin();
-    network_config::load();
 
-    Serial.println("Configuration:");
-    serializeJson(network_config::get(), Serial);
-
-    names.load();
-
-    WiFi.hostname(hostname);
-    wifi_control.init(button);
+    {
+        // compare with a boot after removing /network.bin and /names.bin to see what the snapshots save
+        const unsigned long start = micros();
+        const bool config_snapshot = network_config::load();
+        const unsigned long config_done = micros();
+        const bool names_snapshot = names.load();
+        const unsigned long names_done = micros();
+
+        Serial.printf("Boot timing: network config loaded from %s in %lu us, %u names loaded from %s in %lu us.\n",
+                      config_snapshot ? "snapshot" : "JSON", config_done - start,
+                      names.size(), names_snapshot ? "snapshot" : "JSON", names_done - config_done);
+    }
 
+    // start ingesting readings as soon as possible, networking is brought up later from loop()
     {
         BLEDevice::init("");
-        active_scan_enabled = false;
-        restart_scan();
+        restart_scan(gateway.is_active_scan_enabled());
     }
+}
 
-    server.on("/readings", HTTP_GET, [] {
-        std::lock_guard<std::mutex> guard(mutex);
-
-        JsonDocument json;
-
-        for (auto & kv : readings) {
-            const auto & address = kv.first;
-            const String address_str = BLEAddress(address).toString().c_str();
-            const auto & reading = kv.second;
-
-            auto e = json[address_str].to<JsonObject>();
-            e["temperature"] = reading.temperature;
-            e["humidity"] = reading.humidity;
-            e["battery"]["voltage"] = reading.battery_voltage;
-            e["battery"]["level"] = reading.battery_level;
-            e["name"] = names[address];
-            e["age"] = reading.age.elapsed();
-        }
-
-        server.sendJson(json);
-    });
+void start_network_stage() {
+    switch (network_stage) {
+        case NetworkStage::wifi:
+            Serial.println("Configuration:");
+            serializeJson(network_config::get(), Serial);
+
+            WiFi.hostname(hostname);
+            wifi_control.init(button);
+            wifi_initialized = true;
+
+            network_stage = NetworkStage::web_server;
+            break;
+
+        case NetworkStage::web_server:
+            server.on("/readings", HTTP_GET, [] {
+                std::lock_guard<std::mutex> guard(mutex);
+
+                JsonDocument json;
+
+                for (auto & kv : gateway.get_readings()) {
+                    const auto & address = kv.first;
+                    const String address_str = Ingest::to_string(address).c_str();
+                    const auto & reading = kv.second;
+
+                    auto e = json[address_str].to<JsonObject>();
+                    e["temperature"] = reading.temperature;
+                    e["humidity"] = reading.humidity;
+                    e["battery"]["voltage"] = reading.battery_voltage;
+                    e["battery"]["level"] = reading.battery_level;
+                    e["name"] = names[address];
+                    e["age"] = 0.001 * (millis() - reading.timestamp);
+                }
 
-    server.on("/devices", HTTP_GET, [] {
-        std::lock_guard<std::mutex> guard(mutex);
-        server.sendJson(names.json());
-    });
+                server.sendJson(json);
+            });
 
-    server.on("/devices", HTTP_DELETE, [] {
-        std::lock_guard<std::mutex> guard(mutex);
-        names.clear();
-        syslog.println(F("Enabling active scan after dropping names."));
-        active_scan_enabled = true;
-        restart_scan();
-        server.send(200, "text/plain", "OK");
-    });
+            server.on("/devices", HTTP_GET, [] {
+                std::lock_guard<std::mutex> guard(mutex);
+                server.sendJson(names.json());
+            });
 
-    server.serveStatic("/", SPIFFS, "/html/", "max-age=86400");
+            server.on("/devices", HTTP_DELETE, [] {
+                std::lock_guard<std::mutex> guard(mutex);
+                names.clear();
+                syslog.println(F("Enabling active scan after dropping names."));
+                gateway.enable_active_scan();
+                server.send(200, "text/plain", "OK");
+            });
 
-    mqtt.connected_callback = [] {
-        syslog.println("MQTT connected, publishing readings...");
-        last_mqtt_reconnect.reset();
-    };
+            StaticAssets::init(server);
 
-    server.begin();
-    picomq.begin();
-    mqtt.begin();
+            Capture::init(server);
 
-    HomeAssistant::init();
-
-    {
-        ArduinoOTA.setHostname(hostname.c_str());
-        if (ota_password.length()) {
-            ArduinoOTA.setPassword(ota_password.c_str());
-        }
-        ArduinoOTA.begin();
-    }
+            network_config::init(server);
 
-    wifi_control.get_connectivity_level = [] {
-        unsigned int ret = 1;
-        if (mqtt.connected()) { ++ret; }
-        if (HomeAssistant::connected()) { ++ret; }
-        return ret;
-    };
-}
+            server.begin();
 
-void publish_readings() {
-    static PicoUtils::Stopwatch last_publish;
+            network_stage = NetworkStage::mqtt;
+            break;
 
-    bool got_all_names = true;
+        case NetworkStage::mqtt:
+            mqtt.connected_callback = [] {
+                syslog.println("MQTT connected, publishing readings...");
+                std::lock_guard<std::mutex> guard(mutex);
+                gateway.reconnected();
+            };
 
-    const bool just_reconnected = last_publish.elapsed() >= last_mqtt_reconnect.elapsed();
+            picomq.begin();
+            mqtt.begin();
 
-    for (const auto & kv : readings) {
-        auto address = kv.first;
-        const auto & reading = kv.second;
+            network_stage = NetworkStage::home_assistant;
+            break;
 
-        const bool already_published = (reading.age.elapsed() > last_publish.elapsed());
-        const bool recent = (reading.age.elapsed() <= 120);
+        case NetworkStage::home_assistant:
+            HomeAssistant::init();
 
-        const char * name = names[address];
-        got_all_names = got_all_names && name;
+            network_stage = NetworkStage::ota;
+            break;
 
-        if (already_published && !(recent && just_reconnected)) {
-            // already published and we haven't just reconnected
-            continue;
-        }
+        case NetworkStage::ota:
+            ArduinoOTA.setHostname(hostname.c_str());
+            if (ota_password.length()) {
+                ArduinoOTA.setPassword(ota_password.c_str());
+            }
+            ArduinoOTA.begin();
 
-        static const String topic_prefix = "celsius/" + get_board_id() + "/";
+            wifi_control.get_connectivity_level = [] {
+                unsigned int ret = 1;
+                if (mqtt.connected()) { ++ret; }
+                if (HomeAssistant::connected()) { ++ret; }
+                return ret;
+            };
 
-        if (name) {
-            picomq.publish(topic_prefix + name + "/temperature", reading.temperature);
-            picomq.publish(topic_prefix + name + "/humidity", reading.humidity);
-            mqtt.publish(topic_prefix + name + "/temperature", String(reading.temperature));
-        }
+            syslog.printf("Networking started %lu ms after boot.\n", millis());
 
-        picomq.publish(topic_prefix + String(address.toString().c_str()) + "/temperature", reading.temperature);
-        picomq.publish(topic_prefix + String(address.toString().c_str()) + "/humidity", reading.humidity);
-        mqtt.publish(topic_prefix + String(address.toString().c_str()) + "/temperature", String(reading.temperature));
-    }
+            network_stage = NetworkStage::ready;
+            break;
 
-    last_publish.reset();
-
-    if (active_scan_enabled && (got_all_names || (active_scan_stopwatch.elapsed() >= 3 * 60))) {
-        syslog.println(F("Disabling active scan."));
-        active_scan_enabled = false;
-        restart_scan();
-    } else if (ScanCallbacks::active_scan_required) {
-        active_scan_stopwatch.reset();
-        if (!active_scan_enabled) {
-            syslog.println(F("Enabling active scan."));
-            active_scan_enabled = true;
-            restart_scan();
-        }
+        case NetworkStage::ready:
+            break;
     }
-
-    ScanCallbacks::active_scan_required = false;
 }
 
 void no_wifi_reset() {
@@ -359,19 +305,27 @@ void no_wifi_reset() {
 }
 
 void loop() {
+    if (network_stage != NetworkStage::ready) {
+        // BLE ingest keeps running in its own task in the meantime
+        start_network_stage();
+        return;
+    }
+
     ArduinoOTA.handle();
 
     server.handleClient();
     picomq.loop();
     mqtt.loop();
     wifi_control.tick();
+    Capture::tick();
+    network_config::tick();
 
     {
         std::lock_guard<std::mutex> guard(mutex);
-        publish_readings();
+        gateway.publish_readings();
         HomeAssistant::tick();
 
-        if (!active_scan_enabled && names.is_dirty() && last_name_save.elapsed() >= 30 * 60) {
+        if (!gateway.is_active_scan_enabled() && names.is_dirty() && last_name_save.elapsed() >= 30 * 60) {
             names.save();
             last_name_save.reset();
         }
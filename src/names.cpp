@@ -3,19 +3,67 @@
 #include <PicoUtils.h>
 
 #include "names.h"
+#include "snapshot.h"
 
 namespace {
 const char NAMES_PATH[] PROGMEM = "/names.json";
+const char SNAPSHOT_PATH[] PROGMEM = "/names.bin";
 }
 
-void Names::load() {
+bool Names::load() {
+    const uint32_t crc = get_file_crc(SPIFFS, FPSTR(NAMES_PATH));
+    if (load_snapshot(crc)) {
+        return true;
+    }
+
+    load_json();
+    save_snapshot(crc);
+    return false;
+}
+
+bool Names::load_snapshot(uint32_t source_crc) {
+    names.clear();
+
+    SnapshotReader snapshot;
+    if (!snapshot.load(SPIFFS, FPSTR(SNAPSHOT_PATH), source_crc)) {
+        return false;
+    }
+
+    const uint16_t count = snapshot.read_u16();
+    for (uint16_t i = 0; snapshot.ok() && (i < count); ++i) {
+        Ingest::Address address;
+        snapshot.read_bytes(address.data(), address.size());
+        const String name = snapshot.read_string();
+        if (snapshot.ok()) {
+            names[address] = name;
+        }
+    }
+
+    if (!snapshot.ok()) {
+        names.clear();
+    }
+
+    return snapshot.ok();
+}
+
+void Names::save_snapshot(uint32_t source_crc) const {
+    SnapshotWriter snapshot;
+    snapshot.write_u16(names.size());
+    for (const auto & kv : names) {
+        snapshot.write_bytes(kv.first.data(), kv.first.size());
+        snapshot.write_string(kv.second);
+    }
+    snapshot.save(SPIFFS, FPSTR(SNAPSHOT_PATH), source_crc);
+}
+
+void Names::load_json() {
     names.clear();
     PicoUtils::JsonConfigFile<JsonDocument> json(SPIFFS, FPSTR(NAMES_PATH));
     for (auto kv : json.as<JsonObject>()) {
-        BLEAddress address(kv.key().c_str());
+        Ingest::Address address;
         const String name = kv.value().as<const char *>();
 
-        if (name.length() == 0) {
+        if (!Ingest::parse_address(kv.key().c_str(), address) || (name.length() == 0)) {
             continue;
         }
         names[address] = name;
@@ -27,7 +75,7 @@ JsonDocument Names::json() const {
 
     for (auto & kv : names) {
         const auto & address = kv.first;
-        const String address_str = BLEAddress(address).toString().c_str();
+        const String address_str = Ingest::to_string(address).c_str();
         const auto & name = kv.second;
         json[address_str] = name;
     }
@@ -42,6 +90,7 @@ void Names::save() {
     if (file) {
         file.close();
     }
+    save_snapshot(get_file_crc(SPIFFS, FPSTR(NAMES_PATH)));
     dirty = false;
 }
 
@@ -49,12 +98,12 @@ void Names::clear() {
     names.clear();
 }
 
-const char * Names::operator[](const BLEAddress & address) const {
+const char * Names::operator[](const Ingest::Address & address) const {
     const auto it = names.find(address);
     return it != names.end() ? it->second.c_str() : nullptr;
 }
 
-void Names::set(const BLEAddress & address, const String & name) {
+void Names::set(const Ingest::Address & address, const String & name) {
     names[address] = name;
     dirty = true;
 }
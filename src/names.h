@@ -4,7 +4,8 @@
 
 #include <Arduino.h>
 #include <ArduinoJson.h>
-#include <BLEDevice.h>
+
+#include <ingest.h>
 
 class Names {
     public:
@@ -12,17 +13,23 @@ class Names {
 
         JsonDocument json() const;
 
-        void load();
+        // Returns true if the names were loaded from their snapshot.
+        bool load();
         void save();
         void clear();
 
-        const char * operator[](const BLEAddress & address) const;
-        void set(const BLEAddress & address, const String & name);
+        const char * operator[](const Ingest::Address & address) const;
+        void set(const Ingest::Address & address, const String & name);
 
+        size_t size() const { return names.size(); }
         bool is_dirty() const { return dirty; }
 
     protected:
-        std::map<BLEAddress, String> names;
+        void load_json();
+        bool load_snapshot(uint32_t source_crc);
+        void save_snapshot(uint32_t source_crc) const;
+
+        std::map<Ingest::Address, String> names;
         bool dirty;
 };
 
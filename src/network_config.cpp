@@ -0,0 +1,372 @@
+#include <SPIFFS.h>
+
+#include <PicoMQTT.h>
+#include <PicoSyslog.h>
+#include <PicoUtils.h>
+
+#include "globals.h"
+#include "hass.h"
+#include "network_config.h"
+#include "snapshot.h"
+
+extern String hostname;
+extern String ota_password;
+extern PicoMQTT::Client mqtt;
+extern PicoSyslog::Logger syslog;
+
+namespace {
+
+const char CONFIG_PATH[] PROGMEM = "/network.json";
+const char CONFIG_TMP_PATH[] PROGMEM = "/network.json.tmp";
+const char SNAPSHOT_PATH[] PROGMEM = "/network.bin";
+
+// How often network.json is checked for changes made behind our back.
+const unsigned long WATCH_INTERVAL_MILLIS = 10 * 1000;
+
+struct ServerConfig {
+    String host;
+    uint16_t port;
+    String username;
+    String password;
+
+    bool operator==(const ServerConfig & other) const {
+        return (host == other.host) && (port == other.port)
+               && (username == other.username) && (password == other.password);
+    }
+
+    bool operator!=(const ServerConfig & other) const {
+        return !(*this == other);
+    }
+};
+
+struct Config {
+    String hostname;
+    ServerConfig mqtt;
+    String syslog;
+    String ota_password;
+    ServerConfig hass;
+    String autodiscovery_topic;
+};
+
+uint32_t loaded_crc;
+PicoUtils::Stopwatch last_check;
+
+bool is_optional_string(JsonVariantConst value) {
+    return value.isNull() || value.is<const char *>();
+}
+
+bool is_optional_port(JsonVariantConst value) {
+    return value.isNull() || (value.is<uint16_t>() && value.as<uint16_t>() > 0);
+}
+
+bool is_optional_server(JsonVariantConst value) {
+    return value.isNull() || (value.is<JsonObjectConst>()
+                              && is_optional_string(value["server"])
+                              && is_optional_port(value["port"])
+                              && is_optional_string(value["username"])
+                              && is_optional_string(value["password"]));
+}
+
+const char * validate(const JsonDocument & json) {
+    if (!json.is<JsonObjectConst>()) {
+        return "Configuration must be a JSON object";
+    }
+
+    if (!is_optional_string(json["hostname"]) || (json["hostname"].is<const char *>() && !json["hostname"].as<String>().length())) {
+        return "Invalid hostname";
+    }
+
+    if (!is_optional_server(json["mqtt"])) {
+        return "Invalid MQTT settings";
+    }
+
+    if (!is_optional_string(json["syslog"])) {
+        return "Invalid syslog server";
+    }
+
+    if (!is_optional_string(json["ota_password"])) {
+        return "Invalid OTA password";
+    }
+
+    if (!is_optional_server(json["hass"]) || !is_optional_string(json["hass"]["autodiscovery_topic"])) {
+        return "Invalid Home Assistant settings";
+    }
+
+    return nullptr;
+}
+
+Config get_defaults() {
+    Config config;
+    config.hostname = "kelvin_" + get_board_id();
+    config.mqtt.host = "calor.local";
+    config.mqtt.port = 1883;
+    config.mqtt.username = "kelvin";
+    config.mqtt.password = "harara";
+    config.syslog = "192.168.1.100";
+    config.ota_password = "";
+    config.hass.host = "";
+    config.hass.port = 1883;
+    config.hass.username = "";
+    config.hass.password = "";
+    config.autodiscovery_topic = "homeassistant";
+    return config;
+}
+
+// Settings missing from the JSON are taken from base.
+Config parse(const JsonDocument & json, const Config & base) {
+    Config config;
+    config.hostname = json["hostname"] | base.hostname;
+    config.mqtt.host = json["mqtt"]["server"] | base.mqtt.host;
+    config.mqtt.port = json["mqtt"]["port"] | base.mqtt.port;
+    config.mqtt.username = json["mqtt"]["username"] | base.mqtt.username;
+    config.mqtt.password = json["mqtt"]["password"] | base.mqtt.password;
+    config.syslog = json["syslog"] | base.syslog;
+    config.ota_password = json["ota_password"] | base.ota_password;
+    config.hass.host = json["hass"]["server"] | base.hass.host;
+    config.hass.port = json["hass"]["port"] | base.hass.port;
+    config.hass.username = json["hass"]["username"] | base.hass.username;
+    config.hass.password = json["hass"]["password"] | base.hass.password;
+    config.autodiscovery_topic = json["hass"]["autodiscovery_topic"] | base.autodiscovery_topic;
+    return config;
+}
+
+JsonDocument to_json(const Config & config) {
+    JsonDocument json;
+    json["hostname"] = config.hostname;
+    json["mqtt"]["server"] = config.mqtt.host;
+    json["mqtt"]["port"] = config.mqtt.port;
+    json["mqtt"]["username"] = config.mqtt.username;
+    json["mqtt"]["password"] = config.mqtt.password;
+    json["syslog"] = config.syslog;
+    json["ota_password"] = config.ota_password;
+    json["hass"]["server"] = config.hass.host;
+    json["hass"]["port"] = config.hass.port;
+    json["hass"]["username"] = config.hass.username;
+    json["hass"]["password"] = config.hass.password;
+    json["hass"]["autodiscovery_topic"] = config.autodiscovery_topic;
+    return json;
+}
+
+Config current() {
+    Config config;
+    config.hostname = hostname;
+    config.mqtt.host = mqtt.host;
+    config.mqtt.port = mqtt.port;
+    config.mqtt.username = mqtt.username;
+    config.mqtt.password = mqtt.password;
+    config.syslog = syslog.server;
+    config.ota_password = ota_password;
+    config.hass.host = HomeAssistant::mqtt.host;
+    config.hass.port = HomeAssistant::mqtt.port;
+    config.hass.username = HomeAssistant::mqtt.username;
+    config.hass.password = HomeAssistant::mqtt.password;
+    config.autodiscovery_topic = HomeAssistant::autodiscovery_topic;
+    return config;
+}
+
+void set(const Config & config) {
+    hostname = config.hostname;
+    mqtt.host = config.mqtt.host;
+    mqtt.port = config.mqtt.port;
+    mqtt.username = config.mqtt.username;
+    mqtt.password = config.mqtt.password;
+    syslog.server = config.syslog;
+    syslog.host = hostname;
+    ota_password = config.ota_password;
+    HomeAssistant::mqtt.host = config.hass.host;
+    HomeAssistant::mqtt.port = config.hass.port;
+    HomeAssistant::mqtt.username = config.hass.username;
+    HomeAssistant::mqtt.password = config.hass.password;
+    HomeAssistant::autodiscovery_topic = config.autodiscovery_topic;
+}
+
+bool load_snapshot(Config & config, uint32_t source_crc) {
+    SnapshotReader snapshot;
+    if (!snapshot.load(SPIFFS, FPSTR(SNAPSHOT_PATH), source_crc)) {
+        return false;
+    }
+
+    config.hostname = snapshot.read_string();
+    config.mqtt.host = snapshot.read_string();
+    config.mqtt.port = snapshot.read_u16();
+    config.mqtt.username = snapshot.read_string();
+    config.mqtt.password = snapshot.read_string();
+    config.syslog = snapshot.read_string();
+    config.ota_password = snapshot.read_string();
+    config.hass.host = snapshot.read_string();
+    config.hass.port = snapshot.read_u16();
+    config.hass.username = snapshot.read_string();
+    config.hass.password = snapshot.read_string();
+    config.autodiscovery_topic = snapshot.read_string();
+
+    return snapshot.ok();
+}
+
+void save_snapshot(const Config & config, uint32_t source_crc) {
+    SnapshotWriter snapshot;
+    snapshot.write_string(config.hostname);
+    snapshot.write_string(config.mqtt.host);
+    snapshot.write_u16(config.mqtt.port);
+    snapshot.write_string(config.mqtt.username);
+    snapshot.write_string(config.mqtt.password);
+    snapshot.write_string(config.syslog);
+    snapshot.write_string(config.ota_password);
+    snapshot.write_string(config.hass.host);
+    snapshot.write_u16(config.hass.port);
+    snapshot.write_string(config.hass.username);
+    snapshot.write_string(config.hass.password);
+    snapshot.write_string(config.autodiscovery_topic);
+    snapshot.save(SPIFFS, FPSTR(SNAPSHOT_PATH), source_crc);
+}
+
+bool save(const Config & config) {
+    // write to a temporary file first, so that a power loss never leaves a truncated network.json
+    auto file = SPIFFS.open(FPSTR(CONFIG_TMP_PATH), "w");
+    if (!file) {
+        return false;
+    }
+    const bool success = serializeJson(to_json(config), file) > 0;
+    file.close();
+
+    if (!success) {
+        SPIFFS.remove(FPSTR(CONFIG_TMP_PATH));
+        return false;
+    }
+
+    SPIFFS.remove(FPSTR(CONFIG_PATH));
+    if (!SPIFFS.rename(FPSTR(CONFIG_TMP_PATH), FPSTR(CONFIG_PATH))) {
+        return false;
+    }
+
+    loaded_crc = get_file_crc(SPIFFS, FPSTR(CONFIG_PATH));
+    save_snapshot(config, loaded_crc);
+    return true;
+}
+
+// Swaps in a new configuration at runtime and reconnects only the clients whose settings changed.
+void reload(const Config & config) {
+    Config old;
+    {
+        // hold the lock only for the swap, logging and disconnecting below do network I/O
+        std::lock_guard<std::mutex> guard(mutex);
+        old = current();
+        set(config);
+    }
+
+    if (old.hostname != config.hostname) {
+        syslog.println(F("Hostname changed, Wi-Fi and OTA will use the new hostname after restart."));
+    }
+
+    if (old.syslog != config.syslog) {
+        syslog.printf("Syslog server changed to %s.\n", config.syslog.c_str());
+    }
+
+    if (old.ota_password != config.ota_password) {
+        // ArduinoOTA is only configured at boot, a request can never turn off upload protection on a running device
+        syslog.println(F("OTA password changed, it will be used after restart."));
+    }
+
+    if (old.mqtt != config.mqtt) {
+        syslog.printf("MQTT settings changed, reconnecting to %s:%i.\n", config.mqtt.host.c_str(), config.mqtt.port);
+        mqtt.disconnect();
+    }
+
+    if ((old.hass != config.hass) || (old.autodiscovery_topic != config.autodiscovery_topic)) {
+        // autodiscovery is resent on reconnect
+        syslog.printf("Home Assistant settings changed, reconnecting to %s:%i.\n",
+                      config.hass.host.c_str(), config.hass.port);
+        HomeAssistant::mqtt.disconnect();
+    }
+}
+
+}
+
+namespace network_config {
+
+bool load() {
+    // save() removes network.json before renaming the temporary file, finish the job if it was interrupted
+    if (!SPIFFS.exists(FPSTR(CONFIG_PATH)) && SPIFFS.exists(FPSTR(CONFIG_TMP_PATH))) {
+        SPIFFS.rename(FPSTR(CONFIG_TMP_PATH), FPSTR(CONFIG_PATH));
+    }
+
+    Config config;
+    loaded_crc = get_file_crc(SPIFFS, FPSTR(CONFIG_PATH));
+
+    // fall back to the JSON file if the snapshot is missing, stale or corrupted
+    const bool from_snapshot = load_snapshot(config, loaded_crc);
+    if (!from_snapshot) {
+        PicoUtils::JsonConfigFile<JsonDocument> json(SPIFFS, FPSTR(CONFIG_PATH));
+        config = parse(json, get_defaults());
+        save_snapshot(config, loaded_crc);
+    }
+
+    set(config);
+    return from_snapshot;
+}
+
+JsonDocument get() {
+    return to_json(current());
+}
+
+void init(WebServer & server) {
+    server.on("/config", HTTP_PUT, [&server] {
+        JsonDocument json;
+        if (deserializeJson(json, server.arg("plain"))) {
+            server.send(400, "text/plain", "Invalid JSON");
+            return;
+        }
+
+        const char * error = validate(json);
+        if (error) {
+            server.send(400, "text/plain", error);
+            return;
+        }
+
+        // settings missing from the request are left unchanged
+        const Config config = parse(json, current());
+
+        if ((config.ota_password != ota_password) && (ota_password != (json["current_ota_password"] | ""))) {
+            server.send(403, "text/plain", "Changing the OTA password requires current_ota_password");
+            return;
+        }
+
+        if (!save(config)) {
+            server.send(500, "text/plain", "Error saving configuration");
+            return;
+        }
+
+        syslog.println(F("Configuration updated, reloading."));
+        reload(config);
+        server.send(200, "text/plain", "OK");
+    });
+}
+
+void tick() {
+    if (last_check.elapsed_millis() < WATCH_INTERVAL_MILLIS) {
+        return;
+    }
+
+    last_check.reset();
+
+    const uint32_t crc = get_file_crc(SPIFFS, FPSTR(CONFIG_PATH));
+    if (crc == loaded_crc) {
+        return;
+    }
+
+    // remember the checksum even if the file turns out to be invalid, so that errors are reported only once
+    loaded_crc = crc;
+
+    PicoUtils::JsonConfigFile<JsonDocument> json(SPIFFS, FPSTR(CONFIG_PATH));
+    const char * error = validate(json);
+    if (error) {
+        syslog.printf("Configuration file changed, but is invalid: %s\n", error);
+        return;
+    }
+
+    syslog.println(F("Configuration file changed, reloading."));
+    const Config config = parse(json, get_defaults());
+    save_snapshot(config, crc);
+    reload(config);
+}
+
+}
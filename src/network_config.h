@@ -0,0 +1,16 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <WebServer.h>
+
+namespace network_config {
+
+// Returns true if the configuration was loaded from its snapshot.
+bool load();
+JsonDocument get();
+
+void init(WebServer & server);
+void tick();
+
+}
@@ -0,0 +1,150 @@
+#include "snapshot.h"
+
+namespace {
+
+const uint32_t MAGIC = 0x4e564c4b;  // "KLVN"
+const uint8_t VERSION = 2;
+
+struct Header {
+    uint32_t magic;
+    uint8_t version;
+    uint32_t source_crc;
+    uint32_t payload_size;
+    uint32_t crc;
+} __attribute__((packed));
+
+uint32_t crc32_update(uint32_t crc, const uint8_t * data, size_t size) {
+    while (size--) {
+        crc ^= *data++;
+        for (int i = 0; i < 8; ++i) {
+            crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+        }
+    }
+    return crc;
+}
+
+uint32_t crc32(const uint8_t * data, size_t size) {
+    return ~crc32_update(0xffffffff, data, size);
+}
+
+}
+
+uint32_t get_file_crc(fs::FS & fs, const String & path) {
+    if (!fs.exists(path)) {
+        return 0;
+    }
+
+    auto file = fs.open(path, "r");
+    if (!file) {
+        return 0;
+    }
+
+    uint32_t crc = 0xffffffff;
+    uint8_t buffer[64];
+    size_t size;
+    while ((size = file.read(buffer, sizeof(buffer))) > 0) {
+        crc = crc32_update(crc, buffer, size);
+    }
+    file.close();
+
+    return ~crc;
+}
+
+void SnapshotWriter::write_u16(uint16_t value) {
+    data.push_back(value & 0xff);
+    data.push_back(value >> 8);
+}
+
+void SnapshotWriter::write_bytes(const uint8_t * buffer, size_t size) {
+    data.insert(data.end(), buffer, buffer + size);
+}
+
+void SnapshotWriter::write_string(const String & value) {
+    write_u16(value.length());
+    write_bytes((const uint8_t *) value.c_str(), value.length());
+}
+
+bool SnapshotWriter::save(fs::FS & fs, const String & path, uint32_t source_crc) const {
+    Header header;
+    header.magic = MAGIC;
+    header.version = VERSION;
+    header.source_crc = source_crc;
+    header.payload_size = data.size();
+    header.crc = crc32(data.data(), data.size());
+
+    auto file = fs.open(path, "w");
+    if (!file) {
+        return false;
+    }
+
+    const bool success = (file.write((const uint8_t *) &header, sizeof(header)) == sizeof(header))
+                         && (file.write(data.data(), data.size()) == data.size());
+    file.close();
+
+    if (!success) {
+        fs.remove(path);
+    }
+
+    return success;
+}
+
+bool SnapshotReader::load(fs::FS & fs, const String & path, uint32_t source_crc) {
+    data.clear();
+    position = 0;
+    valid = false;
+
+    if (!fs.exists(path)) {
+        return false;
+    }
+
+    auto file = fs.open(path, "r");
+    if (!file) {
+        return false;
+    }
+
+    Header header;
+    if (file.read((uint8_t *) &header, sizeof(header)) != sizeof(header)
+            || header.magic != MAGIC
+            || header.version != VERSION
+            || header.source_crc != source_crc
+            || header.payload_size != file.size() - sizeof(header)) {
+        file.close();
+        return false;
+    }
+
+    data.resize(header.payload_size);
+    const bool complete = (file.read(data.data(), data.size()) == data.size());
+    file.close();
+
+    valid = complete && (header.crc == crc32(data.data(), data.size()));
+
+    return valid;
+}
+
+uint16_t SnapshotReader::read_u16() {
+    uint8_t buffer[2] = {0, 0};
+    read_bytes(buffer, 2);
+    return buffer[0] | (buffer[1] << 8);
+}
+
+bool SnapshotReader::read_bytes(uint8_t * buffer, size_t size) {
+    if (!valid || (data.size() - position < size)) {
+        valid = false;
+        return false;
+    }
+    memcpy(buffer, data.data() + position, size);
+    position += size;
+    return true;
+}
+
+String SnapshotReader::read_string() {
+    const uint16_t length = read_u16();
+    if (!valid || (data.size() - position < length)) {
+        valid = false;
+        return String();
+    }
+    String value;
+    value.concat((const char *) data.data() + position, length);
+    position += length;
+    return value;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+
+#include <Arduino.h>
+#include <FS.h>
+
+// Snapshots are compact binary copies of the JSON config files, which can be
+// loaded at boot without parsing JSON.  The JSON files remain the source of
+// truth: a snapshot is only used if its checksum is valid and the checksum of
+// the JSON file still matches the one recorded in the snapshot.  Callers pass
+// that checksum in, so that the JSON file is only read once per load or save.
+
+// Returns the CRC32 of the file's content or 0 if the file doesn't exist.
+uint32_t get_file_crc(fs::FS & fs, const String & path);
+
+class SnapshotWriter {
+    public:
+        void write_u16(uint16_t value);
+        void write_bytes(const uint8_t * buffer, size_t size);
+        void write_string(const String & value);
+
+        bool save(fs::FS & fs, const String & path, uint32_t source_crc) const;
+
+    protected:
+        std::vector<uint8_t> data;
+};
+
+class SnapshotReader {
+    public:
+        SnapshotReader(): position(0), valid(false) {}
+
+        bool load(fs::FS & fs, const String & path, uint32_t source_crc);
+
+        uint16_t read_u16();
+        bool read_bytes(uint8_t * buffer, size_t size);
+        String read_string();
+
+        bool ok() const { return valid; }
+
+    protected:
+        std::vector<uint8_t> data;
+        size_t position;
+        bool valid;
+};
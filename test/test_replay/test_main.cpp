@@ -0,0 +1,202 @@
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <unity.h>
+
+#include <capture_file.h>
+#include <ingest.h>
+#include <replay.h>
+
+// capture.bin holds 6 minutes of traffic from three thermometers advertising every 5 seconds:
+//   a4:c1:38:00:00:01 always advertises its name,
+//   a4:c1:38:00:00:02 starts advertising its name from its fourth advertisement,
+//   a4:c1:38:00:00:03 never advertises a name.
+
+namespace {
+
+std::vector<Ingest::Advertisement> advertisements;
+
+const Ingest::Address SENSOR_1 = {0xa4, 0xc1, 0x38, 0x00, 0x00, 0x01};
+const Ingest::Address SENSOR_2 = {0xa4, 0xc1, 0x38, 0x00, 0x00, 0x02};
+const Ingest::Address SENSOR_3 = {0xa4, 0xc1, 0x38, 0x00, 0x00, 0x03};
+
+bool load_capture() {
+    std::string path = __FILE__;
+    path = path.substr(0, path.find_last_of("/\\") + 1) + "capture.bin";
+
+    for (const auto & candidate : {path, std::string("test/test_replay/capture.bin")}) {
+        std::ifstream file(candidate, std::ios::binary);
+        if (!file) {
+            continue;
+        }
+        const std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        return Ingest::parse_capture(data.data(), data.size(), advertisements);
+    }
+
+    return false;
+}
+
+void replay(Ingest::Replay & replay) {
+    for (const auto & advertisement : advertisements) {
+        replay.feed(advertisement);
+    }
+}
+
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_capture_parsed_in_order() {
+    TEST_ASSERT_EQUAL(216, advertisements.size());
+    for (size_t i = 1; i < advertisements.size(); ++i) {
+        TEST_ASSERT_TRUE(advertisements[i - 1].timestamp < advertisements[i].timestamp);
+    }
+}
+
+void test_ring_order() {
+    // ring of 2 records, 3 written: the oldest record is in the second slot
+    Ingest::CaptureHeader header = {Ingest::CAPTURE_MAGIC, Ingest::CAPTURE_VERSION, sizeof(Ingest::Advertisement), 2, 3};
+    std::vector<uint8_t> data(Ingest::get_capture_size(header));
+    memcpy(data.data(), &header, sizeof(header));
+
+    Ingest::Advertisement record = advertisements[0];
+    record.timestamp = 3;
+    memcpy(data.data() + sizeof(header), &record, sizeof(record));
+    record.timestamp = 2;
+    memcpy(data.data() + sizeof(header) + sizeof(record), &record, sizeof(record));
+
+    std::vector<Ingest::Advertisement> parsed;
+    TEST_ASSERT_TRUE(Ingest::parse_capture(data.data(), data.size(), parsed));
+    TEST_ASSERT_EQUAL(2, parsed.size());
+    TEST_ASSERT_EQUAL_UINT32(2, parsed[0].timestamp);
+    TEST_ASSERT_EQUAL_UINT32(3, parsed[1].timestamp);
+
+    TEST_ASSERT_FALSE(Ingest::parse_capture(data.data(), data.size() - 1, parsed));
+}
+
+void test_readings() {
+    Ingest::Replay sandbox;
+    replay(sandbox);
+
+    const auto & readings = sandbox.gateway.get_readings();
+    TEST_ASSERT_EQUAL(3, readings.size());
+
+    const auto & reading = readings.at(SENSOR_1);
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 21.71, reading.temperature);
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 41.00, reading.humidity);
+    TEST_ASSERT_EQUAL(91, reading.battery_level);
+    TEST_ASSERT_FLOAT_WITHIN(0.0001, 2.999, reading.battery_voltage);
+    TEST_ASSERT_EQUAL_UINT32(advertisements[advertisements.size() - 3].timestamp, reading.timestamp);
+
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 22.71, readings.at(SENSOR_2).temperature);
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 23.71, readings.at(SENSOR_3).temperature);
+}
+
+void test_names() {
+    Ingest::Replay sandbox;
+    replay(sandbox);
+
+    TEST_ASSERT_EQUAL(2, sandbox.names.size());
+    TEST_ASSERT_EQUAL_STRING("ATC_000001", sandbox.get_name(SENSOR_1));
+    TEST_ASSERT_EQUAL_STRING("ATC_000002", sandbox.get_name(SENSOR_2));
+    TEST_ASSERT_NULL(sandbox.get_name(SENSOR_3));
+}
+
+void test_publications() {
+    Ingest::Replay sandbox;
+    replay(sandbox);
+
+    // every reading is published exactly once, as soon as it arrives
+    TEST_ASSERT_EQUAL(advertisements.size(), sandbox.publications.size());
+    for (size_t i = 0; i < advertisements.size(); ++i) {
+        TEST_ASSERT_EQUAL_UINT32(advertisements[i].timestamp, sandbox.publications[i].timestamp);
+    }
+
+    size_t named = 0;
+    for (const auto & publication : sandbox.publications) {
+        named += !publication.name.empty();
+    }
+    TEST_ASSERT_EQUAL(72 + 69, named);
+}
+
+void test_active_scan() {
+    Ingest::Replay sandbox;
+    replay(sandbox);
+
+    // enabled by the first unnamed reading, disabled 3 minutes after the last request,
+    // because the third sensor never reveals its name
+    TEST_ASSERT_EQUAL(2, sandbox.active_scan_changes.size());
+    TEST_ASSERT_TRUE(sandbox.active_scan_changes[0].enabled);
+    TEST_ASSERT_EQUAL_UINT32(11000, sandbox.active_scan_changes[0].timestamp);
+    TEST_ASSERT_FALSE(sandbox.active_scan_changes[1].enabled);
+    TEST_ASSERT_EQUAL_UINT32(12000 + 3 * 60 * 1000, sandbox.active_scan_changes[1].timestamp);
+}
+
+void test_reconnect_republishes_recent_readings() {
+    Ingest::Replay sandbox;
+    replay(sandbox);
+
+    const size_t published = sandbox.publications.size();
+    const uint32_t last = advertisements.back().timestamp;
+
+    sandbox.advance(last + 1000);
+    TEST_ASSERT_EQUAL(published, sandbox.publications.size());
+
+    sandbox.gateway.reconnected();
+    sandbox.advance(last + 2000);
+    TEST_ASSERT_EQUAL(published + 3, sandbox.publications.size());
+
+    // readings older than 2 minutes are not republished
+    sandbox.gateway.reconnected();
+    sandbox.advance(last + 200 * 1000);
+    TEST_ASSERT_EQUAL(published + 3, sandbox.publications.size());
+}
+
+void test_deterministic() {
+    Ingest::Replay first, second;
+    replay(first);
+    replay(second);
+
+    TEST_ASSERT_TRUE(first.publications == second.publications);
+    TEST_ASSERT_TRUE(first.active_scan_changes == second.active_scan_changes);
+}
+
+void test_benchmark() {
+    const unsigned int repetitions = 200;
+
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < repetitions; ++i) {
+        Ingest::Replay sandbox;
+        replay(sandbox);
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    const double us = std::chrono::duration<double, std::micro>(elapsed).count() / repetitions / advertisements.size();
+    char message[64];
+    snprintf(message, sizeof(message), "%.3f us per replayed advertisement", us);
+    TEST_MESSAGE(message);
+}
+
+int main() {
+    UNITY_BEGIN();
+    if (!load_capture()) {
+        TEST_MESSAGE("Unable to load capture.bin");
+        return UNITY_END() + 1;
+    }
+    RUN_TEST(test_capture_parsed_in_order);
+    RUN_TEST(test_ring_order);
+    RUN_TEST(test_readings);
+    RUN_TEST(test_names);
+    RUN_TEST(test_publications);
+    RUN_TEST(test_active_scan);
+    RUN_TEST(test_reconnect_republishes_recent_readings);
+    RUN_TEST(test_deterministic);
+    RUN_TEST(test_benchmark);
+    return UNITY_END();
+}
@@ -0,0 +1,64 @@
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#include <capture_file.h>
+#include <ingest.h>
+#include <replay.h>
+
+// Host side replayer: runs a capture file, e.g. one downloaded with
+// `capture.py download`, through the ingest logic and prints what the gateway
+// would have published and when it would have switched active scanning.
+//
+// Build and run with:
+//   pio run -e replay
+//   .pio/build/replay/program capture.bin
+
+int main(int argc, char * argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s CAPTURE_FILE\n", argv[0]);
+        return 2;
+    }
+
+    std::ifstream file(argv[1], std::ios::binary);
+    if (!file) {
+        fprintf(stderr, "Error opening %s\n", argv[1]);
+        return 1;
+    }
+
+    const std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    std::vector<Ingest::Advertisement> advertisements;
+    if (!Ingest::parse_capture(data.data(), data.size(), advertisements)) {
+        fprintf(stderr, "%s is not a valid capture file\n", argv[1]);
+        return 1;
+    }
+
+    Ingest::Replay replay;
+    for (const auto & advertisement : advertisements) {
+        replay.feed(advertisement);
+    }
+
+    // timestamps are printed in seconds since the first record, like capture.py dump does
+    const uint32_t start = advertisements.empty() ? 0 : advertisements.front().timestamp;
+
+    printf("Publications:\n");
+    for (const auto & publication : replay.publications) {
+        printf("%10.3f %s %6.2f %6.2f %s\n",
+               (publication.timestamp - start) * 0.001,
+               Ingest::to_string(publication.address).c_str(),
+               publication.temperature, publication.humidity,
+               publication.name.empty() ? "-" : publication.name.c_str());
+    }
+
+    printf("Active scan changes:\n");
+    for (const auto & change : replay.active_scan_changes) {
+        printf("%10.3f %s\n", (change.timestamp - start) * 0.001, change.enabled ? "on" : "off");
+    }
+
+    printf("%zu advertisements, %zu devices, %zu named, %zu publications, %zu active scan changes\n",
+           advertisements.size(), replay.gateway.get_readings().size(), replay.names.size(),
+           replay.publications.size(), replay.active_scan_changes.size());
+
+    return 0;
+}